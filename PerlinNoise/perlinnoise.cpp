@@ -8,6 +8,7 @@
 #include <random>
 #include <algorithm>
 #include <numeric>
+#include <cstring>
 
 // THIS IS A DIRECT TRANSLATION TO C++11 FROM THE REFERENCE
 // JAVA IMPLEMENTATION OF THE IMPROVED PERLIN FUNCTION (see http://mrl.nyu.edu/~perlin/noise/)
@@ -34,6 +35,7 @@ PerlinNoise::PerlinNoise() {
         138,236,205,93,222,114,67,29,24,72,243,141,128,195,78,66,215,61,156,180 };
     // Duplicate the permutation vector
     p.insert(p.end(), p.begin(), p.end());
+    initPermutation();
 }
 
 // Generate a new permutation vector based on the value of seed
@@ -51,9 +53,15 @@ PerlinNoise::PerlinNoise(unsigned int seed) {
 
     // Duplicate the permutation vector
     p.insert(p.end(), p.begin(), p.end());
+    initPermutation();
 }
 
-double PerlinNoise::noise(double x, double y, double z) {
+void PerlinNoise::initPermutation() {
+    for (std::size_t i = 0; i < 512; ++i)
+        perm[i] = std::uint8_t(p[i]);
+}
+
+double PerlinNoise::noise(double x, double y, double z) const {
     // Find the unit cube that contains the point
     int X = (int) floor(x) & 255;
     int Y = (int) floor(y) & 255;
@@ -97,3 +105,193 @@ double PerlinNoise::grad(int hash, double x, double y, double z) {
            v = h < 4 ? y : h == 12 || h == 14 ? x : z;
     return ((h & 1) == 0 ? u : -u) + ((h & 2) == 0 ? v : -v);
 }
+
+// BATCH VERSIONS
+//
+// The kernels below use the GCC/Clang vector extensions so the same code can be compiled for SSE2 (2 doubles / 4 floats)
+// and AVX2 (4 doubles / 8 floats). The hashes are looked up per lane from the byte permutation table (gather-free),
+// everything else is computed on whole vectors. The arithmetic mirrors noise() operation by operation.
+
+namespace {
+
+#if defined(__GNUC__)
+// Everything is force-inlined into the dispatch functions below, so the vector ABI warnings don't apply.
+// GCC reports them at the end of the translation unit, so this can't be popped again
+#pragma GCC diagnostic ignored "-Wpsabi"
+#define PERLIN_INLINE inline __attribute__((always_inline))
+
+template <typename T> struct LaneInt;
+template <> struct LaneInt<double> { using type = std::int64_t; };
+template <> struct LaneInt<float>  { using type = std::int32_t; };
+
+template <typename T, int Lanes>
+struct Vec {
+    typedef T V __attribute__((vector_size(sizeof(T) * Lanes)));
+    typedef typename LaneInt<T>::type I __attribute__((vector_size(sizeof(T) * Lanes)));
+};
+
+template <typename V>
+PERLIN_INLINE V vfade(const V &t) {
+    return t * t * t * (t * (t * 6 - 15) + 10);
+}
+
+template <typename V>
+PERLIN_INLINE V vlerp(const V &t, const V &a, const V &b) {
+    return a + t * (b - a);
+}
+
+template <typename V, typename I>
+PERLIN_INLINE V vgrad(const I &hash, const V &x, const V &y, const V &z) {
+    const I h = hash & 15;
+    // Convert lower 4 bits of hash into 12 gradient directions
+    const V u = h < 8 ? x : y;
+    const V v = h < 4 ? y : ((h == 12) | (h == 14)) ? x : z;
+    return ((h & 1) == 0 ? u : -u) + ((h & 2) == 0 ? v : -v);
+}
+
+// floor() without SSE4.1, exact for values within the int range
+template <typename V, typename I>
+PERLIN_INLINE V vfloor(const V &v) {
+    const V t = __builtin_convertvector(__builtin_convertvector(v, I), V);
+    return t > v ? t - 1 : t;
+}
+
+template <typename T, int Lanes>
+PERLIN_INLINE void noiseBlock(const std::uint8_t *perm, const T *xs, const T *ys, T scale, T z, int Z, T w, T *out) {
+    using V = typename Vec<T, Lanes>::V;
+    using I = typename Vec<T, Lanes>::I;
+
+    V x, y;
+    std::memcpy(&x, xs, sizeof(V));
+    std::memcpy(&y, ys, sizeof(V));
+    x *= scale;
+    y *= scale;
+
+    // Find the unit cube that contains the point
+    const V fx = vfloor<V, I>(x);
+    const V fy = vfloor<V, I>(y);
+    const I X = __builtin_convertvector(fx, I) & 255;
+    const I Y = __builtin_convertvector(fy, I) & 255;
+
+    // Find relative x, y of point in cube
+    x -= fx;
+    y -= fy;
+
+    // Compute fade curves for x and y
+    const V u = vfade(x);
+    const V v = vfade(y);
+
+    // Hash coordinates of the 8 cube corners, one lane at a time
+    I hAA, hBA, hAB, hBB, hAA1, hBA1, hAB1, hBB1;
+    for (int l = 0; l < Lanes; ++l) {
+        const int A = perm[X[l]] + int(Y[l]);
+        const int AA = perm[A] + Z;
+        const int AB = perm[A + 1] + Z;
+        const int B = perm[X[l] + 1] + int(Y[l]);
+        const int BA = perm[B] + Z;
+        const int BB = perm[B + 1] + Z;
+
+        hAA[l] = perm[AA];
+        hBA[l] = perm[BA];
+        hAB[l] = perm[AB];
+        hBB[l] = perm[BB];
+        hAA1[l] = perm[AA + 1];
+        hBA1[l] = perm[BA + 1];
+        hAB1[l] = perm[AB + 1];
+        hBB1[l] = perm[BB + 1];
+    }
+
+    const V zv = V{} + z;
+    const V zv1 = zv - 1;
+    const V x1 = x - 1;
+    const V y1 = y - 1;
+    const V wv = V{} + w;
+
+    // Add blended results from 8 corners of cube
+    const V res = vlerp(wv, vlerp(v, vlerp(u, vgrad(hAA, x, y, zv), vgrad(hBA, x1, y, zv)), vlerp(u, vgrad(hAB, x, y1, zv), vgrad(hBB, x1, y1, zv))), vlerp(v, vlerp(u, vgrad(hAA1, x, y, zv1), vgrad(hBA1, x1, y, zv1)), vlerp(u, vgrad(hAB1, x, y1, zv1), vgrad(hBB1, x1, y1, zv1))));
+    const V result = (res + T(1.0)) / T(2.0);
+    std::memcpy(out, &result, sizeof(V));
+}
+
+template <typename T, int Lanes>
+PERLIN_INLINE void noiseBatch(const std::uint8_t *perm, const T *x, const T *y, T z, T *out, std::size_t count, T scale) {
+    // z is shared, so its cube, fraction and fade only need to be computed once
+    const T fz = std::floor(z);
+    const int Z = int(fz) & 255;
+    z -= fz;
+    const T w = z * z * z * (z * (z * 6 - 15) + 10);
+
+    std::size_t i = 0;
+    for (; i + Lanes <= count; i += Lanes)
+        noiseBlock<T, Lanes>(perm, x + i, y + i, scale, z, Z, w, out + i);
+
+    // Pad the remainder to a full block
+    if (i < count) {
+        T tx[Lanes] = {}, ty[Lanes] = {}, to[Lanes];
+        std::memcpy(tx, x + i, (count - i) * sizeof(T));
+        std::memcpy(ty, y + i, (count - i) * sizeof(T));
+        noiseBlock<T, Lanes>(perm, tx, ty, scale, z, Z, w, to);
+        std::memcpy(out + i, to, (count - i) * sizeof(T));
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+void noiseAvx2(const std::uint8_t *perm, const double *x, const double *y, double z, double *out, std::size_t count, double scale) {
+    noiseBatch<double, 4>(perm, x, y, z, out, count, scale);
+}
+
+__attribute__((target("avx2")))
+void noiseAvx2(const std::uint8_t *perm, const float *x, const float *y, float z, float *out, std::size_t count, float scale) {
+    noiseBatch<float, 8>(perm, x, y, z, out, count, scale);
+}
+
+bool hasAvx2() {
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+}
+#else
+template <typename T>
+void noiseAvx2(const std::uint8_t *, const T *, const T *, T, T *, std::size_t, T) {}
+
+bool hasAvx2() {
+    return false;
+}
+#endif
+
+// 16 byte vectors, SSE2 on x86 and NEON on ARM
+template <typename T>
+void noise128(const std::uint8_t *perm, const T *x, const T *y, T z, T *out, std::size_t count, T scale) {
+    noiseBatch<T, 16 / sizeof(T)>(perm, x, y, z, out, count, scale);
+}
+
+template <typename T>
+void noiseDispatch(const std::uint8_t *perm, const T *x, const T *y, T z, T *out, std::size_t count, T scale) {
+    if (hasAvx2())
+        noiseAvx2(perm, x, y, z, out, count, scale);
+    else
+        noise128(perm, x, y, z, out, count, scale);
+}
+
+#undef PERLIN_INLINE
+#endif // __GNUC__
+
+} // namespace
+
+void PerlinNoise::noise(const double *x, const double *y, double z, double *out, std::size_t count, double scale) const {
+#if defined(__GNUC__)
+    noiseDispatch(perm, x, y, z, out, count, scale);
+#else
+    for (std::size_t i = 0; i < count; ++i)
+        out[i] = noise(x[i] * scale, y[i] * scale, z);
+#endif
+}
+
+void PerlinNoise::noise(const float *x, const float *y, float z, float *out, std::size_t count, float scale) const {
+#if defined(__GNUC__)
+    noiseDispatch(perm, x, y, z, out, count, scale);
+#else
+    for (std::size_t i = 0; i < count; ++i)
+        out[i] = float(noise(double(x[i] * scale), double(y[i] * scale), double(z)));
+#endif
+}
@@ -1,5 +1,7 @@
 // https://github.com/DeiVadder/QNoise
 
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 
 // THIS CLASS IS A TRANSLATION TO C++11 FROM THE REFERENCE
@@ -14,17 +16,28 @@
 class PerlinNoise {
     // The permutation vector
     std::vector<int> p;
+    // The same permutation as bytes, used by the batch functions (512 bytes fit into 8 cache lines)
+    std::uint8_t perm[512];
 public:
     // Initialize with the reference values for the permutation vector
     PerlinNoise();
     // Generate a new permutation vector based on the value of seed
     PerlinNoise(unsigned int seed);
     // Get a noise value, for 2D images z can have any value
-    double noise(double x, double y, double z);
+    double noise(double x, double y, double z) const;
+
+    // Batch versions: out[i] = noise(x[i] * scale, y[i] * scale, z) for i in [0, count).
+    // Uses SSE2 or AVX2 kernels (picked at runtime) where available and a scalar loop otherwise.
+    // The double version performs the same operations as noise() and matches it exactly, unless the
+    // compiler is allowed to contract multiply-adds differently (e.g. -march with FMA), then within 1e-12.
+    // The float version matches within 2e-6. Coordinates have to be within the int range.
+    void noise(const double *x, const double *y, double z, double *out, std::size_t count, double scale = 1.0) const;
+    void noise(const float *x, const float *y, float z, float *out, std::size_t count, float scale = 1.0f) const;
 private:
-    double fade(double t);
-    double lerp(double t, double a, double b);
-    double grad(int hash, double x, double y, double z);
+    void initPermutation();
+    static double fade(double t);
+    static double lerp(double t, double a, double b);
+    static double grad(int hash, double x, double y, double z);
 };
 
 #endif
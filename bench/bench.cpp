@@ -0,0 +1,414 @@
+#include "../PerlinNoise/perlinnoise.h"
+#include "../src/particlestore.h"
+#include "../src/renderer.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLoggingCategory>
+#include <QRandomGenerator>
+#include <QSysInfo>
+#include <QThread>
+
+#include <algorithm>
+#include <cstdio>
+#include <type_traits>
+#include <vector>
+
+namespace randomly {
+
+// runs the renderer's stages synchronously, without the pipeline threads
+class RendererBench
+{
+public:
+    explicit RendererBench(const RenderInfo &info)
+        : m_renderer(nullptr, info)
+    {
+        m_state.lifeTimes.resize(info.particleCount);
+        m_state.initialLifeTimes.resize(info.particleCount);
+        m_renderer.snapshot(0, m_state);
+    }
+
+    void updateParticles()
+    {
+        m_renderer.step();
+    }
+
+    // updates the particles and takes the state the rasterizer works on
+    void simulate()
+    {
+        updateParticles();
+        m_renderer.snapshot(++m_frame, m_state);
+    }
+
+    void blendTrails(QRgb *pixels)
+    {
+        m_renderer.rasterizeTrails(m_state, pixels);
+    }
+
+    // what the pipeline does for every frame, minus handing it to the encoder
+    void frame()
+    {
+        simulate();
+        m_renderer.rasterize(m_state);
+    }
+
+private:
+    Renderer m_renderer;
+    FrameState m_state;
+    quint64 m_frame = 0;
+};
+
+namespace
+{
+
+template <typename T>
+constexpr const char *scalarName() { return std::is_same_v<T, float> ? "float" : "double"; }
+
+struct Options
+{
+    QString filter;
+    qint64 minTimeNs = 500000000;
+    int minIterations = 3;
+    int threads = 1;
+    uint seed = 0;
+    BlendMode blendMode = BlendMode::Fast;
+    int tileSize = 0;
+};
+
+class Bench
+{
+public:
+    explicit Bench(const Options &options)
+        : m_options(options)
+    {}
+
+    bool wants(const QString &name) const { return name.contains(m_options.filter); }
+
+    // runs fn until both the minimum time and the minimum number of iterations are reached, after one warm up run.
+    // items is the amount of work done per call (noise samples, particles, ...), for a throughput independent of the size
+    template <typename F>
+    void run(const QString &name, const QJsonObject &params, qint64 items, F &&fn)
+    {
+        if (!wants(name))
+            return;
+
+        std::fprintf(stderr, "%s %s ... ", qPrintable(name), QJsonDocument(params).toJson(QJsonDocument::Compact).constData());
+
+        fn();
+
+        std::vector<qint64> times;
+        qint64 total = 0;
+        QElapsedTimer timer;
+
+        while (total < m_options.minTimeNs || int(times.size()) < m_options.minIterations) {
+            timer.start();
+            fn();
+            times.push_back(timer.nsecsElapsed());
+            total += times.back();
+        }
+
+        std::sort(times.begin(), times.end());
+
+        const auto mean = double(total) / times.size();
+
+        QJsonObject result;
+        result["name"] = name;
+        result["params"] = params;
+        result["iterations"] = int(times.size());
+        result["min_ns"] = double(times.front());
+        result["median_ns"] = double(times[times.size() / 2]);
+        result["mean_ns"] = mean;
+        result["items_per_second"] = items * 1e9 / mean;
+        m_results.append(result);
+
+        std::fprintf(stderr, "%.3f ms\n", times[times.size() / 2] / 1e6);
+    }
+
+    RenderInfo renderInfo(QSize size, int particles) const
+    {
+        RenderInfo info;
+        info.size = size;
+        info.particleCount = particles;
+        info.seed = m_options.seed;
+        info.threads = m_options.threads;
+        info.blendMode = m_options.blendMode;
+        info.tileSize = m_options.tileSize;
+        return info;
+    }
+
+    QJsonObject report() const
+    {
+        QJsonObject config;
+        config["threads"] = m_options.threads;
+        config["seed"] = int(m_options.seed);
+        config["blend"] = m_options.blendMode == BlendMode::Fast ? "fast" : "exact";
+        config["tile_size"] = m_options.tileSize;
+        // of the renderer benchmarks, the micro benchmarks cover both
+        config["scalar"] = scalarName<Particle::Scalar>();
+
+        QJsonObject report;
+        report["version"] = RANDOMLY_VERSION;
+        report["cpu"] = QSysInfo::buildCpuArchitecture();
+        report["os"] = QSysInfo::prettyProductName();
+        report["config"] = config;
+        report["benchmarks"] = m_results;
+        return report;
+    }
+
+private:
+    const Options m_options;
+    QJsonArray m_results;
+};
+
+// fixed pseudo random positions within a 1080p frame
+void randomPositions(uint seed, int count, std::vector<qreal> &x, std::vector<qreal> &y)
+{
+    QRandomGenerator rng(seed);
+    x.resize(count);
+    y.resize(count);
+
+    for (int i = 0; i < count; ++i) {
+        x[i] = rng.generateDouble() * 1920;
+        y[i] = rng.generateDouble() * 1080;
+    }
+}
+
+void benchNoise(Bench &bench, uint seed)
+{
+    constexpr int count = 1 << 16;
+    constexpr qreal scale = 0.002;
+
+    const PerlinNoise noise(seed);
+    std::vector<qreal> x, y, out(count);
+    randomPositions(seed, count, x, y);
+
+    const std::vector<float> xf(x.begin(), x.end()), yf(y.begin(), y.end());
+    std::vector<float> outf(count);
+
+    const QJsonObject params{{"samples", count}};
+
+    bench.run("noise/scalar", params, count, [&] {
+        for (int i = 0; i < count; ++i)
+            out[i] = noise.noise(x[i] * scale, y[i] * scale, 0.5);
+    });
+
+    bench.run("noise/batch_double", params, count, [&] {
+        noise.noise(x.data(), y.data(), 0.5, out.data(), count, scale);
+    });
+
+    bench.run("noise/batch_float", params, count, [&] {
+        noise.noise(xf.data(), yf.data(), 0.5f, outf.data(), count, float(scale));
+    });
+}
+
+// both precisions, independent of the one the renderer was built with
+template <typename T>
+void benchTick(Bench &bench, uint seed)
+{
+    constexpr int count = 100000;
+
+    std::vector<qreal> x, y;
+    randomPositions(seed, count, x, y);
+
+    QRandomGenerator rng(seed);
+    std::vector<T> directions(count);
+    for (auto &direction: directions)
+        direction = rng.generateDouble() * Particle::pStep;
+
+    for (const bool fastTrig: {false, true}) {
+        BasicParticleStore<T> particles(count);
+        for (int i = 0; i < count; ++i)
+            particles.init(i, x[i], y[i], Particle::maxLifetime);
+
+        bench.run("tick", {{"particles", count}, {"fast_trig", fastTrig}, {"scalar", scalarName<T>()}}, count, [&] {
+            particles.advance();
+            particles.tick(0, count, directions.data(), 1920, 1080, fastTrig);
+        });
+    }
+}
+
+void benchUpdateParticles(Bench &bench)
+{
+    constexpr int count = 100000;
+
+    if (!bench.wants("update_particles"))
+        return;
+
+    for (const int flowGrid: {0, 8}) {
+        auto info = bench.renderInfo({1920, 1080}, count);
+        info.flowGrid = flowGrid;
+
+        RendererBench renderer(info);
+
+        bench.run("update_particles", {{"particles", count}, {"flow_grid", flowGrid}}, count, [&] {
+            renderer.updateParticles();
+        });
+    }
+}
+
+void benchBlend(Bench &bench)
+{
+    constexpr int count = 100000;
+    const QSize size(1920, 1080);
+
+    // simulating a trail length's worth of frames for every configuration takes longer than the benchmarks themselves
+    if (!bench.wants("blend_trails"))
+        return;
+
+    for (const auto mode: {BlendMode::Exact, BlendMode::Fast}) {
+        for (const int trailLength: {32, Particle::queueSize, 512}) {
+            for (const int tileSize: {0, 128}) {
+                auto info = bench.renderInfo(size, count);
+                info.blendMode = mode;
+                info.trailLength = trailLength;
+                info.tileSize = tileSize;
+
+                RendererBench renderer(info);
+
+                // let the trails spread out a bit, a fresh trail is a single pixel
+                for (int i = 0; i < trailLength; ++i)
+                    renderer.simulate();
+
+                std::vector<QRgb> pixels(std::size_t(size.width()) * size.height(), 0xff2d2d2d);
+
+                const QJsonObject params{{"particles", count}, {"blend", mode == BlendMode::Fast ? "fast" : "exact"},
+                                         {"trail_length", trailLength}, {"tile_size", tileSize}};
+
+                bench.run("blend_trails", params, qint64(count) * trailLength, [&] {
+                    renderer.blendTrails(pixels.data());
+                });
+            }
+        }
+    }
+}
+
+void benchFrames(Bench &bench)
+{
+    for (const auto size: {QSize(1920, 1080), QSize(3840, 2160)}) {
+        for (const int count: {5000, 100000, 1000000}) {
+            const QJsonObject params{{"width", size.width()}, {"height", size.height()}, {"particles", count}};
+            const auto name = QString("frame");
+
+            if (!bench.wants(name))
+                continue;
+
+            RendererBench renderer(bench.renderInfo(size, count));
+
+            bench.run(name, params, 1, [&] {
+                renderer.frame();
+            });
+        }
+    }
+}
+
+// the density mode against blending every sample, at a particle count where many samples land on the same pixel
+void benchRenderModes(Bench &bench)
+{
+    constexpr int count = 1000000;
+    const QSize size(1920, 1080);
+
+    if (!bench.wants("render_mode"))
+        return;
+
+    for (const auto &[renderMode, blendMode]: {std::pair(RenderMode::Trails, BlendMode::Exact),
+                                               std::pair(RenderMode::Trails, BlendMode::Fast),
+                                               std::pair(RenderMode::Density, BlendMode::Exact)}) {
+        auto info = bench.renderInfo(size, count);
+        info.renderMode = renderMode;
+        info.blendMode = blendMode;
+
+        RendererBench renderer(info);
+
+        const QJsonObject params{{"width", size.width()}, {"height", size.height()}, {"particles", count},
+                                 {"render_mode", renderModeName(renderMode)}, {"blend", blendMode == BlendMode::Fast ? "fast" : "exact"}};
+
+        bench.run("render_mode", params, 1, [&] {
+            renderer.frame();
+        });
+    }
+}
+
+} // namespace
+
+} // namespace randomly
+
+using namespace randomly;
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("EffectRendererBench");
+    QCoreApplication::setApplicationVersion(RANDOMLY_VERSION);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Benchmarks for the hot paths of the effect renderer, results are written as JSON");
+    parser.addHelpOption();
+    parser.addVersionOption();
+
+    QCommandLineOption filterOption("filter", "Only run benchmarks whose name contains <text>.", "text");
+    parser.addOption(filterOption);
+
+    QCommandLineOption outputOption({"o", "output"}, "JSON output file\t(default: stdout).", "file", "-");
+    parser.addOption(outputOption);
+
+    QCommandLineOption minTimeOption("min-time", "Minimum time per benchmark in milliseconds\t(default: 500).", "ms", "500");
+    parser.addOption(minTimeOption);
+
+    QCommandLineOption threadsOption({"j", "threads"}, "Number of render threads\t(default: 1).", "count", "1");
+    parser.addOption(threadsOption);
+
+    QCommandLineOption seedOption({"s", "seed"}, "Seed for the noise and the particles\t(default: 0).", "seed", "0");
+    parser.addOption(seedOption);
+
+    QCommandLineOption blendOption("blend", "Trail blending of the full frame benchmarks: exact or fast\t(default: fast).", "mode", "fast");
+    parser.addOption(blendOption);
+
+    QCommandLineOption tileSizeOption("tile-size", "Trail sample tiles of the full frame benchmarks, 0 blends in particle order\t(default: 0).", "px", "0");
+    parser.addOption(tileSizeOption);
+
+    parser.process(app);
+
+    // the renderer's per frame logging would drown the results
+    QLoggingCategory::setFilterRules("randomly.*.info=false");
+
+    Options options;
+    options.filter = parser.value(filterOption);
+    options.minTimeNs = parser.value(minTimeOption).toLongLong() * 1000000;
+    options.threads = std::max(parser.value(threadsOption).toInt(), 1);
+    options.seed = parser.value(seedOption).toUInt();
+    options.blendMode = parser.value(blendOption) == "exact" ? BlendMode::Exact : BlendMode::Fast;
+    options.tileSize = parser.value(tileSizeOption).toInt();
+
+    // the same sizes the renderer accepts from --tile-size
+    if (options.tileSize != 0 && (options.tileSize < 8 || options.tileSize > 4096 || (options.tileSize & (options.tileSize - 1)) != 0)) {
+        std::fprintf(stderr, "invalid tile size %d, expected 0 or a power of two from 8 to 4096\n", options.tileSize);
+        return 1;
+    }
+
+    Bench bench(options);
+
+    benchNoise(bench, options.seed);
+    benchTick<float>(bench, options.seed);
+    benchTick<double>(bench, options.seed);
+    benchUpdateParticles(bench);
+    benchBlend(bench);
+    benchFrames(bench);
+    benchRenderModes(bench);
+
+    const auto json = QJsonDocument(bench.report()).toJson();
+
+    QFile output(parser.value(outputOption));
+    const bool opened = output.fileName() == "-" ? output.open(stdout, QFile::WriteOnly) : output.open(QFile::WriteOnly);
+
+    if (!opened || output.write(json) != json.size()) {
+        std::fprintf(stderr, "could not write %s\n", qPrintable(output.fileName()));
+        return 1;
+    }
+
+    return 0;
+}
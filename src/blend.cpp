@@ -0,0 +1,60 @@
+#include "blend.h"
+
+namespace randomly {
+
+namespace
+{
+
+inline qreal lerp(qreal a, qreal b, qreal t)
+{
+    return (b - a) * t + a;
+}
+
+} // namespace
+
+TrailBlender::TrailBlender(const QColor &particleClr, int trailLength)
+    : m_particleClr(particleClr.toHsl())
+    , m_trailLengthInv(1. / trailLength)
+{
+    const auto pureHue = QColor::fromHslF(m_particleClr.hslHueF(), 1, 0.5);
+
+    m_hueOffset = {
+        qRound((pureHue.redF()   - 0.5) * fixedOne),
+        qRound((pureHue.greenF() - 0.5) * fixedOne),
+        qRound((pureHue.blueF()  - 0.5) * fixedOne),
+    };
+
+    for (int age = 0; age <= trailLength; ++age) {
+        const auto f = age * m_trailLengthInv;
+
+        m_ageFactor[age] = qRound(f * fixedOne);
+        m_saturationTerm[age] = qRound(m_particleClr.hslSaturationF() * (1 - f) * fixedOne);
+        m_lightnessTerm[age] = qRound(m_particleClr.lightnessF() * (1 - f) * fixedOne);
+    }
+
+    for (int sum = 0; sum <= 510; ++sum) {
+        const int divisor = std::min(sum, 510 - sum);
+
+        m_saturationDivisor[sum] = divisor ? qRound(qreal(fixedOne) / divisor) : 0;
+        m_lightness[sum] = qRound(sum * qreal(fixedOne) / 510);
+    }
+}
+
+void TrailBlender::blendExact(QRgb &pixel, int age) const
+{
+    mix(pixel, age * m_trailLengthInv);
+}
+
+void TrailBlender::mix(QRgb &pixel, qreal f) const
+{
+    const auto bgClr = QColor(pixel).toHsl();
+
+    const auto clr = QColor::fromHslF(     m_particleClr.hslHueF(),
+                                      lerp(m_particleClr.hslSaturationF(), bgClr.hslSaturationF(), f),
+                                      lerp(m_particleClr.lightnessF(),     bgClr.lightnessF(),     f)
+                     ).toRgb();
+
+    pixel = qRgba(clr.red(), clr.green(), clr.blue(), qAlpha(pixel));
+}
+
+} // namespace randomly
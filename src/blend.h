@@ -0,0 +1,92 @@
+#ifndef BLEND_H
+#define BLEND_H
+
+#include "particlestore.h"
+
+#include <QColor>
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+
+namespace randomly {
+
+enum class BlendMode
+{
+    Exact, // QColor HSL round trip per sample
+    Fast,  // fixed point HSL with per age tables, at most 1 off per channel and blend
+};
+
+// blends the particle colour into a background pixel by interpolating saturation and lightness in HSL,
+// while always keeping the hue of the particle colour
+class TrailBlender
+{
+public:
+    explicit TrailBlender(const QColor &particleClr, int trailLength = Particle::queueSize);
+
+    // age 0 is the full particle colour, the trail length keeps the pixel as it is
+    void blendExact(QRgb &pixel, int age) const;
+    void blendFast(QRgb &pixel, int age) const;
+
+    // what blendExact() does with the background weight f instead of an age, 0 is the full particle colour, 1 keeps the pixel
+    void mix(QRgb &pixel, qreal f) const;
+
+    template <BlendMode Mode>
+    void blend(QRgb &pixel, int age) const
+    {
+        if constexpr (Mode == BlendMode::Exact)
+            blendExact(pixel, age);
+        else
+            blendFast(pixel, age);
+    }
+
+private:
+    static constexpr int fixedShift = 15;
+    static constexpr int fixedOne = 1 << fixedShift;
+
+    QColor m_particleClr; // HSL
+    qreal m_trailLengthInv;
+
+    // with a fixed hue, every channel is lightness + chroma * (k - 0.5), k being the channel of the pure hue
+    std::array<int, 3> m_hueOffset; // k - 0.5 for red, green, blue
+
+    // only the first trail length + 1 entries are used
+    std::array<int, Particle::maxTrailLength + 1> m_ageFactor;      // f = age / trail length
+    std::array<int, Particle::maxTrailLength + 1> m_saturationTerm; // particle saturation * (1 - f)
+    std::array<int, Particle::maxTrailLength + 1> m_lightnessTerm;  // particle lightness * (1 - f)
+
+    // indexed by max + min of the background channels
+    std::array<int, 511> m_saturationDivisor; // 1 / min(max + min, 510 - max - min)
+    std::array<int, 511> m_lightness;         // (max + min) / 510
+};
+
+inline void TrailBlender::blendFast(QRgb &pixel, int age) const
+{
+    const int r = qRed(pixel);
+    const int g = qGreen(pixel);
+    const int b = qBlue(pixel);
+
+    const int max = std::max(r, std::max(g, b));
+    const int min = std::min(r, std::min(g, b));
+    const int sum = max + min;
+
+    const int bgSaturation = (max - min) * m_saturationDivisor[sum];
+    const int bgLightness = m_lightness[sum];
+
+    const int f = m_ageFactor[age];
+    const int saturation = m_saturationTerm[age] + ((bgSaturation * f) >> fixedShift);
+    const int lightness  = m_lightnessTerm[age]  + ((bgLightness  * f) >> fixedShift);
+
+    const int chroma = ((fixedOne - std::abs(2 * lightness - fixedOne)) * saturation) >> fixedShift;
+
+    const auto channel = [&] (int hueOffset) {
+        const int v = lightness + ((chroma * hueOffset) >> fixedShift);
+        return std::clamp((v * 255 + fixedOne / 2) >> fixedShift, 0, 255);
+    };
+
+    pixel = qRgba(channel(m_hueOffset[0]), channel(m_hueOffset[1]), channel(m_hueOffset[2]), qAlpha(pixel));
+}
+
+} // namespace randomly
+
+#endif // BLEND_H
@@ -0,0 +1,52 @@
+#ifndef COUNTERRNG_H
+#define COUNTERRNG_H
+
+#include <QtGlobal>
+
+namespace randomly {
+
+// counter based random numbers: every value is a hash of the seed and a counter, there is no state to advance.
+// the counter is (stream, index, draw), e.g. (particle, generation, coordinate), so any thread can draw the numbers
+// of any particle in any order and still gets the same ones. the hash is the splitmix64 finalizer, applied twice
+class CounterRng
+{
+public:
+    explicit constexpr CounterRng(quint64 seed)
+        : m_key(mix(seed + golden))
+    {}
+
+    constexpr quint64 bits(quint32 stream, quint32 index, quint32 draw) const
+    {
+        const auto counter = mix(m_key ^ (quint64(stream) << 32 | index));
+        return mix(counter + (quint64(draw) + 1) * golden);
+    }
+
+    // [0, 1) with 53 random bits, like QRandomGenerator::generateDouble()
+    constexpr double uniform(quint32 stream, quint32 index, quint32 draw) const
+    {
+        return (bits(stream, index, draw) >> 11) * 0x1.0p-53;
+    }
+
+    // [lowest, highest), like QRandomGenerator::bounded()
+    constexpr int bounded(quint32 stream, quint32 index, quint32 draw, int lowest, int highest) const
+    {
+        const auto range = quint64(highest - lowest);
+        return lowest + int(((bits(stream, index, draw) >> 32) * range) >> 32);
+    }
+
+private:
+    static constexpr quint64 golden = 0x9e3779b97f4a7c15ull;
+
+    static constexpr quint64 mix(quint64 z)
+    {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    quint64 m_key;
+};
+
+} // namespace randomly
+
+#endif // COUNTERRNG_H
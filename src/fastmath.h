@@ -0,0 +1,77 @@
+#ifndef FASTMATH_H
+#define FASTMATH_H
+
+namespace randomly {
+
+// branch-free sin/cos that the compiler can vectorize when called in a loop, unlike std::sin/std::cos.
+// the argument is reduced to [-pi/4, pi/4] (Cody-Waite, exact for the small quadrants we use) and then
+// evaluated with the cephes minimax polynomials. absolute error stays below 1e-15 for |x| < 1e6
+inline void sinCos(double x, double &s, double &c)
+{
+    constexpr double twoOverPi = 0.63661977236758134308;
+    constexpr double pio2Hi    = 1.57079632673412561417e+00; // first 33 bits of pi/2
+    constexpr double pio2Lo    = 6.07710050650619224932e-11; // pi/2 - pio2Hi
+    constexpr double roundMagic = 6755399441055744.0; // 1.5 * 2^52, adding and subtracting it rounds to nearest
+
+    const double q = (x * twoOverPi + roundMagic) - roundMagic;
+    const int quadrant = int(q) & 3;
+
+    const double r = (x - q * pio2Hi) - q * pio2Lo;
+    const double z = r * r;
+
+    const double sr = r + r * z * (((((1.58962301576546568060e-10 * z
+                                     - 2.50507477628578072866e-8) * z
+                                     + 2.75573136213857245213e-6) * z
+                                     - 1.98412698295895385996e-4) * z
+                                     + 8.33333333332211858878e-3) * z
+                                     - 1.66666666666666307295e-1);
+
+    const double cr = 1.0 - 0.5 * z + z * z * (((((-1.13585365213876817300e-11 * z
+                                                  + 2.08757008419747316778e-9) * z
+                                                  - 2.75573141792967388112e-7) * z
+                                                  + 2.48015872888517045348e-5) * z
+                                                  - 1.38888888888730564116e-3) * z
+                                                  + 4.16666666666665929218e-2);
+
+    // rotate by the quadrant: (sin, cos) -> (cos, -sin) -> (-sin, -cos) -> (-cos, sin)
+    const double ss = (quadrant & 1) ? cr : sr;
+    const double cc = (quadrant & 1) ? sr : cr;
+
+    s = (quadrant & 2) ? -ss : ss;
+    c = ((quadrant + 1) & 2) ? -cc : cc;
+}
+
+// the same in single precision with the cephes sinf/cosf polynomials, pi/2 is split into three parts.
+// absolute error stays below 1e-6 for |x| < 1e3
+inline void sinCos(float x, float &s, float &c)
+{
+    constexpr float twoOverPi = 0.636619772f;
+    constexpr float pio2Hi    = 1.5703125f;
+    constexpr float pio2Mid   = 4.83751296997070312500e-4f;
+    constexpr float pio2Lo    = 7.54978995489188216e-8f;
+    constexpr float roundMagic = 12582912.f; // 1.5 * 2^23
+
+    const float q = (x * twoOverPi + roundMagic) - roundMagic;
+    const int quadrant = int(q) & 3;
+
+    const float r = ((x - q * pio2Hi) - q * pio2Mid) - q * pio2Lo;
+    const float z = r * r;
+
+    const float sr = r + r * z * ((-1.9515295891e-4f * z
+                                   + 8.3321608736e-3f) * z
+                                   - 1.6666654611e-1f);
+
+    const float cr = 1.f - 0.5f * z + z * z * ((2.443315711809948e-5f * z
+                                                - 1.388731625493765e-3f) * z
+                                                + 4.166664568298827e-2f);
+
+    const float ss = (quadrant & 1) ? cr : sr;
+    const float cc = (quadrant & 1) ? sr : cr;
+
+    s = (quadrant & 2) ? -ss : ss;
+    c = ((quadrant + 1) & 2) ? -cc : cc;
+}
+
+} // namespace randomly
+
+#endif // FASTMATH_H
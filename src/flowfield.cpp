@@ -0,0 +1,88 @@
+#include "flowfield.h"
+
+#include "../PerlinNoise/perlinnoise.h"
+
+#include <algorithm>
+
+namespace randomly {
+
+FlowField::FlowField(const PerlinNoise &noise, QSize size, qreal scale, qreal dz, int cellSize, int keyframeInterval)
+    : m_noise(noise)
+    , m_scale(scale)
+    , m_dz(dz)
+    , m_cellSize(std::max(cellSize, 1))
+    , m_cellSizeInv(1. / m_cellSize)
+    , m_keyframeInterval(std::max(keyframeInterval, 1))
+    , m_gridWidth(size.width() / m_cellSize + 2)
+    , m_gridHeight(size.height() / m_cellSize + 2)
+    , m_slice0(std::size_t(m_gridWidth) * m_gridHeight)
+    , m_slice1(m_slice0.size())
+    , m_blended(m_slice0.size())
+    , m_rowX(m_gridWidth)
+    , m_rowY(m_gridWidth)
+{
+    for (int gx = 0; gx < m_gridWidth; ++gx)
+        m_rowX[gx] = gx * m_cellSize;
+
+    sampleSlice(m_slice0, 0);
+    sampleSlice(m_slice1, 1);
+}
+
+void FlowField::prepare(quint64 frame)
+{
+    const auto keyframe = frame / m_keyframeInterval;
+
+    if (keyframe != m_keyframe) {
+        // usually we just moved on by one keyframe, so the old upper slice can be reused
+        if (keyframe == m_keyframe + 1)
+            std::swap(m_slice0, m_slice1);
+        else
+            sampleSlice(m_slice0, keyframe);
+
+        sampleSlice(m_slice1, keyframe + 1);
+        m_keyframe = keyframe;
+    }
+
+    const qreal t = qreal(frame - keyframe * m_keyframeInterval) / m_keyframeInterval;
+
+    for (std::size_t i = 0; i < m_blended.size(); ++i)
+        m_blended[i] = m_slice0[i] + t * (m_slice1[i] - m_slice0[i]);
+}
+
+template <typename T>
+void FlowField::sample(const T *x, const T *y, T *out, int count) const
+{
+    for (int i = 0; i < count; ++i) {
+        const qreal gx = x[i] * m_cellSizeInv;
+        const qreal gy = y[i] * m_cellSizeInv;
+
+        const int ix = std::min(int(gx), m_gridWidth - 2);
+        const int iy = std::min(int(gy), m_gridHeight - 2);
+
+        const qreal fx = gx - ix;
+        const qreal fy = gy - iy;
+
+        const auto row0 = m_blended.data() + std::size_t(iy) * m_gridWidth + ix;
+        const auto row1 = row0 + m_gridWidth;
+
+        const qreal top    = row0[0] + fx * (row0[1] - row0[0]);
+        const qreal bottom = row1[0] + fx * (row1[1] - row1[0]);
+
+        out[i] = top + fy * (bottom - top);
+    }
+}
+
+template void FlowField::sample(const float *x, const float *y, float *out, int count) const;
+template void FlowField::sample(const double *x, const double *y, double *out, int count) const;
+
+void FlowField::sampleSlice(std::vector<qreal> &slice, quint64 keyframe)
+{
+    const qreal z = qreal(keyframe * m_keyframeInterval) * m_dz;
+
+    for (int gy = 0; gy < m_gridHeight; ++gy) {
+        std::fill(m_rowY.begin(), m_rowY.end(), qreal(gy * m_cellSize));
+        m_noise.noise(m_rowX.data(), m_rowY.data(), z, slice.data() + std::size_t(gy) * m_gridWidth, m_gridWidth, m_scale);
+    }
+}
+
+} // namespace randomly
@@ -0,0 +1,58 @@
+#ifndef FLOWFIELD_H
+#define FLOWFIELD_H
+
+#include <QSize>
+
+#include <vector>
+
+class PerlinNoise;
+
+namespace randomly {
+
+// approximates the noise field by sampling it on a coarse grid at keyframe z-slices.
+// particles read it using trilinear interpolation (bilinear within the blend of the two surrounding keyframes),
+// which makes the per particle cost independent of the noise function
+class FlowField
+{
+public:
+    // cellSize is the grid spacing in pixels, keyframeInterval the number of frames between two sampled slices,
+    // dz how much z advances per frame
+    FlowField(const PerlinNoise &noise, QSize size, qreal scale, qreal dz, int cellSize, int keyframeInterval);
+
+    // samples the keyframes around `frame` if necessary and blends them for this frame
+    void prepare(quint64 frame);
+
+    // out[i] = approximated noise value at (x[i], y[i]) for the prepared frame, for float and double positions
+    template <typename T>
+    void sample(const T *x, const T *y, T *out, int count) const;
+
+    int cellSize() const { return m_cellSize; }
+    int keyframeInterval() const { return m_keyframeInterval; }
+
+private:
+    void sampleSlice(std::vector<qreal> &slice, quint64 keyframe);
+
+    const PerlinNoise &m_noise;
+
+    const qreal m_scale;
+    const qreal m_dz;
+    const int m_cellSize;
+    const qreal m_cellSizeInv;
+    const int m_keyframeInterval;
+
+    // grid points are at multiples of m_cellSize and cover [0, width] x [0, height]
+    const int m_gridWidth;
+    const int m_gridHeight;
+
+    quint64 m_keyframe = 0; // index of the keyframe in m_slice0
+    std::vector<qreal> m_slice0;
+    std::vector<qreal> m_slice1;
+    std::vector<qreal> m_blended;
+
+    std::vector<qreal> m_rowX; // x coordinates of one grid row, for the batch noise
+    std::vector<qreal> m_rowY;
+};
+
+} // namespace randomly
+
+#endif // FLOWFIELD_H
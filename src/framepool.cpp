@@ -0,0 +1,163 @@
+#include "framepool.h"
+
+#include <QAbstractVideoBuffer>
+#include <QMutexLocker>
+
+namespace randomly {
+
+// hands the memory of a pooled frame to QVideoFrame and returns it to the pool when the frame is destroyed
+class PooledVideoBuffer : public QAbstractVideoBuffer
+{
+public:
+    // planes points into data
+    PooledVideoBuffer(std::shared_ptr<FramePool> pool, std::unique_ptr<uchar[]> data,
+                      const QVideoFrameFormat &format, const MapData &planes)
+        : m_pool(std::move(pool))
+        , m_data(std::move(data))
+        , m_format(format)
+        , m_planes(planes)
+    {}
+
+    // a null pool means the buffer was a temporary one and is simply freed
+    ~PooledVideoBuffer() override
+    {
+        if (m_pool)
+            m_pool->release(std::move(m_data));
+    }
+
+    MapData map(QVideoFrame::MapMode mode) override;
+    QVideoFrameFormat format() const override { return m_format; }
+
+private:
+    std::shared_ptr<FramePool> m_pool;
+    std::unique_ptr<uchar[]> m_data;
+
+    const QVideoFrameFormat m_format;
+    const MapData m_planes;
+};
+
+QAbstractVideoBuffer::MapData PooledVideoBuffer::map(QVideoFrame::MapMode mode)
+{
+    Q_UNUSED(mode);
+
+    return m_planes;
+}
+
+namespace
+{
+
+QVideoFrameFormat::PixelFormat videoFormat(PixelFormat format)
+{
+    switch (format) {
+    case PixelFormat::Argb32:
+        return QVideoFrameFormat::pixelFormatFromImageFormat(QImage::Format_ARGB32);
+    case PixelFormat::I420:
+        return QVideoFrameFormat::Format_YUV420P;
+    case PixelFormat::Nv12:
+        return QVideoFrameFormat::Format_NV12;
+    }
+
+    Q_UNREACHABLE();
+}
+
+} // namespace
+
+FramePool::FramePool(QSize size, int capacity, PixelFormat format)
+    : m_size(size)
+    , m_capacity(std::max(capacity, 1))
+    , m_pixelFormat(format)
+    , m_format(size, videoFormat(format))
+{
+    const int chromaWidth = chromaSize(size.width());
+    const int chromaHeight = chromaSize(size.height());
+
+    switch (format) {
+    case PixelFormat::Argb32:
+        m_planeCount = 1;
+        m_bytesPerLine[0] = size.width() * 4;
+        break;
+    case PixelFormat::I420:
+        m_planeCount = 3;
+        m_bytesPerLine[0] = size.width();
+        m_bytesPerLine[1] = chromaWidth;
+        m_bytesPerLine[2] = chromaWidth;
+        break;
+    case PixelFormat::Nv12:
+        m_planeCount = 2;
+        m_bytesPerLine[0] = size.width();
+        m_bytesPerLine[1] = 2 * chromaWidth;
+        break;
+    }
+
+    for (int plane = 0; plane < m_planeCount; ++plane) {
+        m_planeOffset[plane] = m_bytes;
+        m_planeSize[plane] = m_bytesPerLine[plane] * (plane == 0 ? size.height() : chromaHeight);
+        m_bytes += m_planeSize[plane];
+    }
+}
+
+std::shared_ptr<FramePool> FramePool::create(QSize size, int capacity, PixelFormat format)
+{
+    // the constructor is private, so std::make_shared can't be used
+    return std::shared_ptr<FramePool>(new FramePool(size, capacity, format));
+}
+
+PooledFrame FramePool::acquire()
+{
+    std::unique_ptr<uchar[]> data;
+    bool temporary = false;
+
+    {
+        QMutexLocker lock(&m_mutex);
+        ++m_stats.acquired;
+
+        if (!m_free.empty()) {
+            data = std::move(m_free.back());
+            m_free.pop_back();
+        } else if (m_stats.allocated < m_capacity) {
+            ++m_stats.allocated;
+        } else {
+            ++m_stats.misses;
+            temporary = true;
+        }
+    }
+
+    if (!data)
+        data.reset(new uchar[m_bytes]);
+
+    PooledFrame result;
+    QAbstractVideoBuffer::MapData planes;
+    planes.planeCount = m_planeCount;
+
+    for (int plane = 0; plane < m_planeCount; ++plane) {
+        planes.bytesPerLine[plane] = m_bytesPerLine[plane];
+        planes.data[plane] = data.get() + m_planeOffset[plane];
+        planes.dataSize[plane] = m_planeSize[plane];
+
+        result.planes.data[plane] = planes.data[plane];
+        result.planes.stride[plane] = planes.bytesPerLine[plane];
+    }
+
+    if (m_pixelFormat == PixelFormat::Argb32) {
+        result.image = QImage(data.get(), m_size.width(), m_size.height(), m_bytesPerLine[0], QImage::Format_ARGB32);
+        result.planes = {};
+    }
+
+    result.frame = QVideoFrame(std::make_unique<PooledVideoBuffer>(temporary ? nullptr : shared_from_this(), std::move(data), m_format, planes));
+
+    return result;
+}
+
+FramePool::Stats FramePool::stats() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_stats;
+}
+
+void FramePool::release(std::unique_ptr<uchar[]> data)
+{
+    QMutexLocker lock(&m_mutex);
+    m_free.push_back(std::move(data));
+}
+
+} // namespace randomly
@@ -0,0 +1,80 @@
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include "yuv.h"
+
+#include <QImage>
+#include <QMutex>
+#include <QVideoFrame>
+#include <QVideoFrameFormat>
+
+#include <memory>
+#include <vector>
+
+namespace randomly {
+
+class PooledVideoBuffer;
+
+// the layout of the frames handed to the encoder
+enum class PixelFormat
+{
+    Argb32, // as rendered
+    I420,   // planar 4:2:0, what Theora and Y4M store
+    Nv12,   // 4:2:0 with interleaved chroma, what most hardware encoders take
+};
+
+// a frame to render into: `image` (ARGB32 only) or `planes` (I420 and NV12) and `frame` share the same memory,
+// which goes back to the pool once the last copy of `frame` is gone (usually when the encoder is done with it)
+struct PooledFrame
+{
+    QVideoFrame frame;
+    QImage image;
+    YuvPlanes planes;
+};
+
+// bounded pool of frame buffers, so we don't pay for a fresh allocation (and its page faults) every frame
+class FramePool : public std::enable_shared_from_this<FramePool>
+{
+public:
+    struct Stats
+    {
+        quint64 acquired = 0;
+        quint64 misses = 0; // the pool was dry and a temporary buffer had to be allocated
+        int allocated = 0;
+    };
+
+    // capacity should cover every frame that can be in flight at the same time
+    static std::shared_ptr<FramePool> create(QSize size, int capacity, PixelFormat format = PixelFormat::Argb32);
+
+    PooledFrame acquire();
+
+    Stats stats() const;
+    int capacity() const { return m_capacity; }
+
+private:
+    friend class PooledVideoBuffer;
+
+    FramePool(QSize size, int capacity, PixelFormat format);
+
+    void release(std::unique_ptr<uchar[]> data);
+
+    const QSize m_size;
+    const int m_capacity;
+    const PixelFormat m_pixelFormat;
+    const QVideoFrameFormat m_format;
+
+    // all planes live in one allocation
+    int m_planeCount = 0;
+    int m_bytesPerLine[3] = {};
+    int m_planeOffset[3] = {};
+    int m_planeSize[3] = {};
+    int m_bytes = 0;
+
+    mutable QMutex m_mutex;
+    std::vector<std::unique_ptr<uchar[]>> m_free;
+    Stats m_stats;
+};
+
+} // namespace randomly
+
+#endif // FRAMEPOOL_H
@@ -0,0 +1,255 @@
+#include "framewriter.h"
+
+#include "trace.h"
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QLoggingCategory>
+#include <QThreadPool>
+
+namespace randomly {
+
+namespace
+{
+
+Q_LOGGING_CATEGORY(lcFrameWriter, "randomly.FrameWriter");
+
+// zlib level 1, Qt maps the quality 0..100 linearly onto the compression levels 9..0
+constexpr int fastPngQuality = 80;
+
+bool writeFile(const QString &path, const char *data, qint64 size)
+{
+    QFile file(path);
+
+    if (!file.open(QFile::WriteOnly | QFile::Truncate))
+        return false;
+
+    return file.write(data, size) == size;
+}
+
+QByteArray encodePpm(const QImage &image)
+{
+    const auto header = QString("P6\n%1 %2\n255\n").arg(image.width()).arg(image.height()).toLatin1();
+
+    QByteArray data(header.size() + qsizetype(image.width()) * image.height() * 3, Qt::Uninitialized);
+    std::copy(header.begin(), header.end(), data.begin());
+
+    auto out = reinterpret_cast<uchar *>(data.data()) + header.size();
+
+    for (int y = 0; y < image.height(); ++y) {
+        const auto line = reinterpret_cast<const QRgb *>(image.constScanLine(y));
+
+        for (int x = 0; x < image.width(); ++x) {
+            *out++ = qRed(line[x]);
+            *out++ = qGreen(line[x]);
+            *out++ = qBlue(line[x]);
+        }
+    }
+
+    return data;
+}
+
+// see https://qoiformat.org/qoi-specification.pdf
+QByteArray encodeQoi(const QImage &image)
+{
+    const auto pixelCount = qsizetype(image.width()) * image.height();
+
+    // header, worst case of 5 bytes per pixel and the end marker
+    QByteArray data(14 + pixelCount * 5 + 8, Qt::Uninitialized);
+    auto out = reinterpret_cast<uchar *>(data.data());
+
+    const auto put32 = [&out] (quint32 v) {
+        *out++ = v >> 24;
+        *out++ = v >> 16;
+        *out++ = v >> 8;
+        *out++ = v;
+    };
+
+    put32(0x716f6966); // "qoif"
+    put32(image.width());
+    put32(image.height());
+    *out++ = 4; // channels
+    *out++ = 0; // sRGB with linear alpha
+
+    QRgb index[64] = {};
+    QRgb prev = qRgba(0, 0, 0, 255);
+    int run = 0;
+
+    for (int y = 0; y < image.height(); ++y) {
+        const auto line = reinterpret_cast<const QRgb *>(image.constScanLine(y));
+
+        for (int x = 0; x < image.width(); ++x) {
+            const auto px = line[x];
+
+            if (px == prev) {
+                if (++run == 62) {
+                    *out++ = 0xc0 | (run - 1);
+                    run = 0;
+                }
+
+                continue;
+            }
+
+            if (run > 0) {
+                *out++ = 0xc0 | (run - 1);
+                run = 0;
+            }
+
+            const int r = qRed(px), g = qGreen(px), b = qBlue(px), a = qAlpha(px);
+            const int hash = (r * 3 + g * 5 + b * 7 + a * 11) % 64;
+
+            if (index[hash] == px) {
+                *out++ = hash;
+            } else if (a == qAlpha(prev)) {
+                index[hash] = px;
+
+                const auto vr = qint8(r - qRed(prev));
+                const auto vg = qint8(g - qGreen(prev));
+                const auto vb = qint8(b - qBlue(prev));
+                const auto vgr = qint8(vr - vg);
+                const auto vgb = qint8(vb - vg);
+
+                if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                    *out++ = 0x40 | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+                } else if (vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 && vgb < 8) {
+                    *out++ = 0x80 | (vg + 32);
+                    *out++ = (vgr + 8) << 4 | (vgb + 8);
+                } else {
+                    *out++ = 0xfe;
+                    *out++ = r;
+                    *out++ = g;
+                    *out++ = b;
+                }
+            } else {
+                index[hash] = px;
+
+                *out++ = 0xff;
+                *out++ = r;
+                *out++ = g;
+                *out++ = b;
+                *out++ = a;
+            }
+
+            prev = px;
+        }
+    }
+
+    if (run > 0)
+        *out++ = 0xc0 | (run - 1);
+
+    for (int i = 0; i < 7; ++i)
+        *out++ = 0;
+    *out++ = 1;
+
+    data.resize(out - reinterpret_cast<uchar *>(data.data()));
+    return data;
+}
+
+} // namespace
+
+FrameWriter::FrameWriter(const QString &directory, FrameFormat format, WriterOverflow overflow, int threads, int queueDepth)
+    : m_directory(directory)
+    , m_format(format)
+    , m_overflow(overflow)
+    , m_queueDepth(std::max(queueDepth, 1))
+    , m_pool(std::make_unique<QThreadPool>())
+    , m_slots(m_queueDepth)
+{
+    m_pool->setMaxThreadCount(std::clamp(threads, 1, m_queueDepth));
+
+    if (!QDir().mkpath(m_directory))
+        qCWarning(lcFrameWriter) << "could not create" << m_directory;
+}
+
+FrameWriter::~FrameWriter()
+{
+    finish();
+}
+
+void FrameWriter::write(quint64 frameNumber, const QVideoFrame &frame, const QImage &image)
+{
+    if (!m_slots.tryAcquire()) {
+        if (m_overflow == WriterOverflow::Drop) {
+            ++m_dropped;
+            return;
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+
+        m_slots.acquire();
+
+        ++m_blocked;
+        m_blockedNs += timer.nsecsElapsed();
+    }
+
+    const auto path = QString("%1/frame_%2.%3").arg(m_directory).arg(frameNumber + 1, 3, 10, QChar('0')).arg(suffix(m_format));
+
+    m_pool->start([this, path, frame, image] {
+        const trace::ScopedTimer timer(trace::Stage::Save);
+
+        if (save(path, image)) {
+            ++m_written;
+        } else {
+            ++m_failed;
+            qCWarning(lcFrameWriter) << "failed to write" << path;
+        }
+
+        m_slots.release();
+    });
+}
+
+void FrameWriter::finish()
+{
+    m_pool->waitForDone();
+}
+
+FrameWriter::Stats FrameWriter::stats() const
+{
+    return {m_written, m_failed, m_dropped, m_blocked, m_blockedNs};
+}
+
+const char *FrameWriter::suffix(FrameFormat format)
+{
+    switch (format) {
+    case FrameFormat::Png:
+    case FrameFormat::PngFast:
+        return "png";
+    case FrameFormat::Ppm:
+        return "ppm";
+    case FrameFormat::Qoi:
+        return "qoi";
+    case FrameFormat::Raw:
+        return "argb";
+    }
+
+    return "";
+}
+
+bool FrameWriter::save(const QString &path, const QImage &image) const
+{
+    switch (m_format) {
+    case FrameFormat::Png:
+        return image.save(path, "PNG");
+    case FrameFormat::PngFast:
+        return image.save(path, "PNG", fastPngQuality);
+    case FrameFormat::Ppm: {
+        const auto data = encodePpm(image);
+        return writeFile(path, data.constData(), data.size());
+    }
+    case FrameFormat::Qoi: {
+        const auto data = encodeQoi(image);
+        return writeFile(path, data.constData(), data.size());
+    }
+    case FrameFormat::Raw: {
+        // pooled frames are tightly packed, so the whole image is one block
+        const auto size = qint64(image.bytesPerLine()) * image.height();
+        return writeFile(path, reinterpret_cast<const char *>(image.constBits()), size);
+    }
+    }
+
+    return false;
+}
+
+} // namespace randomly
@@ -0,0 +1,82 @@
+#ifndef FRAMEWRITER_H
+#define FRAMEWRITER_H
+
+#include <QImage>
+#include <QSemaphore>
+#include <QString>
+#include <QVideoFrame>
+
+#include <atomic>
+#include <memory>
+
+class QThreadPool;
+
+namespace randomly {
+
+enum class FrameFormat
+{
+    Png,     // Qt's default compression, small but slow
+    PngFast, // PNG with zlib level 1
+    Ppm,     // binary P6, no compression at all
+    Qoi,     // "Quite OK Image" format, lossless and about as fast as writing raw pixels
+    Raw,     // the ARGB32 bytes as they are in memory, no header
+};
+
+// what to do with a frame if all writer slots are taken
+enum class WriterOverflow
+{
+    Block, // wait for a slot, every frame gets saved
+    Drop,  // skip the frame, rendering never waits for the disk
+};
+
+// writes frames to disk on a pool of background threads.
+// at most queueDepth frames are queued or being written at the same time; the writer keeps a reference to the
+// QVideoFrame, so a pooled buffer only goes back to its FramePool once it is saved
+class FrameWriter
+{
+public:
+    struct Stats
+    {
+        quint64 written = 0;
+        quint64 failed = 0;
+        quint64 dropped = 0;
+        quint64 blocked = 0;   // frames that had to wait for a free slot
+        qint64 blockedNs = 0;  // total time spent waiting
+    };
+
+    FrameWriter(const QString &directory, FrameFormat format, WriterOverflow overflow, int threads, int queueDepth);
+    ~FrameWriter(); // waits for all queued frames
+
+    // image has to point into frame's memory, the frame keeps it alive until the image is written
+    void write(quint64 frameNumber, const QVideoFrame &frame, const QImage &image);
+
+    // blocks until everything that got queued so far is on disk
+    void finish();
+
+    Stats stats() const;
+    int queueDepth() const { return m_queueDepth; }
+    FrameFormat format() const { return m_format; }
+
+    static const char *suffix(FrameFormat format);
+
+private:
+    bool save(const QString &path, const QImage &image) const;
+
+    const QString m_directory;
+    const FrameFormat m_format;
+    const WriterOverflow m_overflow;
+    const int m_queueDepth;
+
+    std::unique_ptr<QThreadPool> m_pool;
+    QSemaphore m_slots;
+
+    std::atomic<quint64> m_written = 0;
+    std::atomic<quint64> m_failed = 0;
+    std::atomic<quint64> m_dropped = 0;
+    std::atomic<quint64> m_blocked = 0;
+    std::atomic<qint64> m_blockedNs = 0;
+};
+
+} // namespace randomly
+
+#endif // FRAMEWRITER_H
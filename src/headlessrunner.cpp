@@ -0,0 +1,69 @@
+#include "headlessrunner.h"
+
+#include "recorder.h"
+#include "renderer.h"
+
+#include <QCoreApplication>
+
+#include <cstdio>
+#include <cstring>
+
+namespace randomly {
+
+namespace
+{
+
+// milliseconds between two progress lines, often enough to see it move but without flooding batch logs
+constexpr qint64 reportInterval = 1000;
+
+} // namespace
+
+HeadlessRunner::HeadlessRunner(QObject *parent)
+    : QObject{parent}
+    , m_recorder(new Recorder(this))
+{
+    m_timer.start();
+
+    connect(m_recorder->renderer(), &Renderer::frameRendered, this, &HeadlessRunner::updateProgress);
+    connect(m_recorder, &Recorder::finished, this, &HeadlessRunner::onFinished);
+}
+
+bool HeadlessRunner::isRequested(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--headless") == 0)
+            return true;
+    }
+
+    return false;
+}
+
+void HeadlessRunner::updateProgress()
+{
+    const auto elapsed = m_timer.elapsed();
+    if (elapsed - m_lastReport < reportInterval)
+        return;
+
+    m_lastReport = elapsed;
+
+    const auto rendered = m_recorder->renderer()->framesRendered();
+    const auto target = m_recorder->renderer()->targetFrames();
+    const auto fps = rendered * 1000. / std::max<qint64>(elapsed, 1);
+    const auto eta = fps > 0 ? (target - rendered) / fps : 0.;
+
+    std::fprintf(stderr, "frame %d/%d (%.0f%%), %.1f FPS, %llu encoded, ETA %.0f s\n",
+                 rendered, target, target > 0 ? 100. * rendered / target : 100., fps, m_recorder->framesSent(), eta);
+}
+
+void HeadlessRunner::onFinished(bool success)
+{
+    const auto seconds = m_timer.elapsed() / 1000.;
+    const auto frames = m_recorder->framesSent();
+
+    std::fprintf(stderr, "%s: %llu frames in %.2f s, %.1f FPS\n",
+                 success ? "done" : "failed", frames, seconds, frames / std::max(seconds, 0.001));
+
+    QCoreApplication::exit(success ? 0 : 1);
+}
+
+} // namespace randomly
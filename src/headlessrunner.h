@@ -0,0 +1,35 @@
+#ifndef HEADLESSRUNNER_H
+#define HEADLESSRUNNER_H
+
+#include <QElapsedTimer>
+#include <QObject>
+
+namespace randomly {
+
+class Recorder;
+
+// the --headless counterpart of PreviewWindow: no widgets and no preview surface, progress goes to stderr
+// and the application exits with 0 on success and 1 on failure
+class HeadlessRunner : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit HeadlessRunner(QObject *parent = nullptr);
+
+    // checked before the application object exists, since the headless mode needs a different one
+    static bool isRequested(int argc, char *argv[]);
+
+private:
+    Recorder *m_recorder;
+
+    QElapsedTimer m_timer;
+    qint64 m_lastReport = 0;
+
+    void updateProgress();
+    void onFinished(bool success);
+};
+
+} // namespace randomly
+
+#endif // HEADLESSRUNNER_H
@@ -0,0 +1,114 @@
+#include "livepreview.h"
+
+#include <QGuiApplication>
+#include <QLoggingCategory>
+#include <QScreen>
+#include <QTimer>
+#include <QVideoSink>
+
+namespace randomly {
+
+namespace
+{
+
+Q_LOGGING_CATEGORY(lcLivePreview, "randomly.LivePreview");
+
+// milliseconds between two statsUpdated()
+constexpr qint64 statsInterval = 1000;
+
+} // namespace
+
+LivePreview::LivePreview(const RenderInfo &info, int divisor, QObject *parent)
+    : QObject{parent}
+    , m_info(info)
+    , m_timer(new QTimer(this))
+{
+    divisor = std::max(divisor, 1);
+
+    m_info.size = QSize(std::max(info.size.width() / divisor, 2), std::max(info.size.height() / divisor, 2));
+    m_info.particleCount = std::max(info.particleCount / (divisor * divisor), 1);
+    m_info.flowGrid = info.flowGrid > 0 ? std::max(info.flowGrid / divisor, 1) : 0;
+    // a quarter of the full render's threads, the recorder leaves them out of its own share
+    m_info.threads = std::max(info.threads / 4, 1);
+    // the rasterizer blocks until the previous frame was shown, so the preview only renders what it shows
+    m_info.renderQueue = 1;
+
+    // only the pixels are of interest, none of the side outputs
+    m_info.saveFrames = false;
+    m_info.tileSize = 0;
+    m_info.compareTrails = false;
+    m_info.verifyMode = VerifyMode::Off;
+    m_info.recordTrajectory.clear();
+    m_info.replayTrajectory.clear();
+    m_info.pixelFormat = PixelFormat::Argb32;
+
+    m_timer->setTimerType(Qt::PreciseTimer);
+    m_timer->setSingleShot(true);
+    connect(m_timer, &QTimer::timeout, this, &LivePreview::present);
+}
+
+LivePreview::~LivePreview() = default;
+
+void LivePreview::start(QVideoSink *sink)
+{
+    m_sink = sink;
+    m_renderer = new Renderer(this, m_info);
+
+    const auto screen = QGuiApplication::primaryScreen();
+    const qreal refreshRate = screen && screen->refreshRate() > 0 ? screen->refreshRate() : 60;
+
+    qCInfo(lcLivePreview).nospace() << "previewing at " << m_info.size.width() << "x" << m_info.size.height() << " with "
+                                    << m_info.particleCount << " particles on " << m_info.threads << " threads, " << refreshRate << " Hz";
+
+    m_period = qint64(1e9 / refreshRate);
+    m_nextPresent = m_period;
+    m_clock.start();
+    m_window.start();
+
+    m_timer->start(int(m_period / 1000000));
+    m_renderer->start();
+}
+
+void LivePreview::scheduleNext()
+{
+    // deadlines on a fixed grid of (fractional) refresh periods, so rounding every interval to whole milliseconds
+    // doesn't add up to a lower rate. missed refreshes are skipped instead of being caught up on
+    const auto now = m_clock.nsecsElapsed();
+
+    do {
+        m_nextPresent += m_period;
+    } while (m_nextPresent <= now);
+
+    m_timer->start(int((m_nextPresent - now + 500000) / 1000000));
+}
+
+void LivePreview::present()
+{
+    QVideoFrame frame;
+    qint64 age = 0;
+
+    // one frame per refresh, taking it frees the queue's only slot and lets the rasterizer start on the next one
+    if (m_renderer->takeFrame(frame, age)) {
+        m_sink->setVideoFrame(frame);
+
+        ++m_framesTaken;
+        ++m_framesShown;
+        m_latencySum += age;
+    }
+
+    // the renderer stops after its last frame, nothing left to pace
+    if (m_framesTaken < quint64(m_renderer->targetFrames()))
+        scheduleNext();
+
+    const auto elapsed = m_window.elapsed();
+    if (elapsed < statsInterval)
+        return;
+
+    emit statsUpdated(m_framesShown * 1000. / elapsed, m_framesShown ? m_latencySum / 1e6 / m_framesShown : 0.);
+
+    m_framesShown = 0;
+    m_latencySum = 0;
+    m_window.start();
+}
+
+} // namespace randomly
@@ -0,0 +1,58 @@
+#ifndef LIVEPREVIEW_H
+#define LIVEPREVIEW_H
+
+#include "renderer.h"
+
+#include <QElapsedTimer>
+#include <QObject>
+
+class QTimer;
+class QVideoSink;
+
+namespace randomly {
+
+// renders the same animation as the recorder on a renderer of its own, at a fraction of the resolution and particles,
+// and shows one frame per display refresh. so the preview keeps moving while the full quality frames take their time
+class LivePreview : public QObject
+{
+    Q_OBJECT
+
+public:
+    // divisor applies to both dimensions, the particle count shrinks with the area so the density stays the same.
+    // the particles that remain are the first ones of the full render and spawn at the same relative positions,
+    // but they still move one pixel per step and sample the noise per pixel, so the flow looks divisor times coarser
+    LivePreview(const RenderInfo &info, int divisor, QObject *parent = nullptr);
+    ~LivePreview();
+
+    // nothing is simulated before this
+    void start(QVideoSink *sink);
+
+    // taken from the full render's share, see the constructor
+    int threads() const { return m_info.threads; }
+
+signals:
+    // about once a second; latency is from finishing a frame's simulation step to showing it
+    void statsUpdated(qreal fps, qreal latencyMs);
+
+private:
+    void present();
+    void scheduleNext();
+
+    RenderInfo m_info;
+    Renderer *m_renderer = nullptr;
+    QVideoSink *m_sink = nullptr;
+    QTimer *m_timer;
+
+    QElapsedTimer m_clock;
+    qint64 m_period = 0; // nanoseconds per display refresh
+    qint64 m_nextPresent = 0; // m_clock nanoseconds
+
+    QElapsedTimer m_window;
+    quint64 m_framesTaken = 0;
+    int m_framesShown = 0; // since m_window started
+    qint64 m_latencySum = 0;
+};
+
+} // namespace randomly
+
+#endif // LIVEPREVIEW_H
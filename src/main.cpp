@@ -1,9 +1,21 @@
+#include "headlessrunner.h"
 #include "previewwindow.h"
 
 #include <QApplication>
+#include <QGuiApplication>
 
 int main(int argc, char *argv[])
 {
+    if (randomly::HeadlessRunner::isRequested(argc, argv)) {
+        // no display server on the render nodes, the offscreen platform still gives QtMultimedia what it needs
+        if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+            qputenv("QT_QPA_PLATFORM", "offscreen");
+
+        QGuiApplication a(argc, argv);
+        randomly::HeadlessRunner r;
+        return a.exec();
+    }
+
     QApplication a(argc, argv);
     randomly::PreviewWindow w;
     w.show();
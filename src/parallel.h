@@ -0,0 +1,43 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <QSemaphore>
+#include <QThreadPool>
+
+#include <algorithm>
+
+namespace randomly {
+
+// splits [0, count) into `chunks` contiguous ranges and calls fn(begin, end, chunk) for each of them.
+// all but the last chunk run on `pool`, the last one runs on the calling thread; returns once every chunk is done
+template <typename F>
+void parallelFor(QThreadPool *pool, int count, int chunks, F &&fn)
+{
+    chunks = std::clamp(chunks, 1, std::max(count, 1));
+
+    const auto chunkBegin = [count, chunks] (int chunk) {
+        return int(qint64(count) * chunk / chunks);
+    };
+
+    if (chunks == 1) {
+        fn(0, count, 0);
+        return;
+    }
+
+    QSemaphore done;
+
+    for (int c = 0; c < chunks - 1; ++c) {
+        pool->start([&, c] {
+            fn(chunkBegin(c), chunkBegin(c + 1), c);
+            done.release();
+        });
+    }
+
+    fn(chunkBegin(chunks - 1), count, chunks - 1);
+
+    done.acquire(chunks - 1);
+}
+
+} // namespace randomly
+
+#endif // PARALLEL_H
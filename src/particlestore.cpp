@@ -0,0 +1,139 @@
+#include "particlestore.h"
+
+#include "fastmath.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace randomly {
+
+namespace
+{
+
+template <typename T>
+inline Particle::Coord quantize(T v)
+{
+    // positions never go below 0, the wrap-around sees to that
+    return Particle::Coord(std::min<T>(v, Particle::maxCoord));
+}
+
+// written without branches so the loop can be vectorized (with FastTrig, std::sin/std::cos are calls)
+template <bool FastTrig, typename T>
+void tickRange(T *__restrict x, T *__restrict y,
+               Particle::Coord *__restrict trailX, Particle::Coord *__restrict trailY,
+               int *__restrict lifeTimes, const T *__restrict directions,
+               int begin, int end, int w, int h)
+{
+    const T width = w;
+    const T height = h;
+
+    for (int p = begin; p < end; ++p) {
+        T s, c;
+
+        if constexpr (FastTrig) {
+            sinCos(directions[p], s, c);
+        } else {
+            s = std::sin(directions[p]);
+            c = std::cos(directions[p]);
+        }
+
+        auto aX = x[p] + c;
+        auto aY = y[p] + s;
+
+        aX = aX > width ? 0 : aX;
+        aX = aX < 0 ? width : aX;
+
+        aY = aY > height ? 0 : aY;
+        aY = aY < 0 ? height : aY;
+
+        x[p] = aX;
+        y[p] = aY;
+        trailX[p] = quantize(aX);
+        trailY[p] = quantize(aY);
+
+        lifeTimes[p] -= lifeTimes[p] != 0;
+    }
+}
+
+} // namespace
+
+template <typename T>
+BasicParticleStore<T>::BasicParticleStore(int count, int historySlots, int trailLength)
+    : m_count(count)
+    , m_trailLength(trailLength)
+    , m_slots(trailLength + historySlots)
+    , m_x(count)
+    , m_y(count)
+    , m_trailX(std::size_t(count) * m_slots)
+    , m_trailY(std::size_t(count) * m_slots)
+    , m_lifeTime(count)
+    , m_initialLifeTime(count)
+{}
+
+template <typename T>
+void BasicParticleStore<T>::init(int idx, T x, T y, int lifetime)
+{
+    m_x[idx] = x;
+    m_y[idx] = y;
+
+    for (int i = 0; i < m_slots; ++i) {
+        m_trailX[std::size_t(i) * m_count + idx] = quantize(x);
+        m_trailY[std::size_t(i) * m_count + idx] = quantize(y);
+    }
+
+    m_lifeTime[idx] = lifetime;
+    m_initialLifeTime[idx] = lifetime;
+}
+
+template <typename T>
+void BasicParticleStore<T>::fillTrails(int begin, int end)
+{
+    const auto headX = trailX(0);
+    const auto headY = trailY(0);
+
+    for (int i = 0; i < m_slots; ++i) {
+        if (i == slot(0, m_head))
+            continue;
+
+        std::copy(headX + begin, headX + end, m_trailX.data() + std::size_t(i) * m_count + begin);
+        std::copy(headY + begin, headY + end, m_trailY.data() + std::size_t(i) * m_count + begin);
+    }
+}
+
+template <typename T>
+std::size_t BasicParticleStore<T>::bytesPerParticle() const
+{
+    return 2 * sizeof(T) + 2 * sizeof(int) + trailBytesPerParticle();
+}
+
+template <typename T>
+void BasicParticleStore<T>::tick(int begin, int end, const T *directions, int w, int h, bool fastTrig)
+{
+    if (fastTrig)
+        tickRange<true>(m_x.data(), m_y.data(), trailX(0), trailY(0), lifeTimes(), directions, begin, end, w, h);
+    else
+        tickRange<false>(m_x.data(), m_y.data(), trailX(0), trailY(0), lifeTimes(), directions, begin, end, w, h);
+}
+
+template <typename T>
+void BasicParticleStore<T>::reset(int idx, T newX, T newY, int lifetime)
+{
+    move(idx, newX, newY);
+
+    m_initialLifeTime[idx] = lifetime;
+    m_lifeTime[idx] = lifetime;
+}
+
+template <typename T>
+void BasicParticleStore<T>::move(int idx, T newX, T newY)
+{
+    m_x[idx] = newX;
+    m_y[idx] = newY;
+    trailX(0)[idx] = quantize(newX);
+    trailY(0)[idx] = quantize(newY);
+}
+
+template class BasicParticleStore<float>;
+template class BasicParticleStore<double>;
+
+} // namespace randomly
@@ -0,0 +1,113 @@
+#ifndef PARTICLESTORE_H
+#define PARTICLESTORE_H
+
+#include <QtGlobal>
+
+#include <vector>
+
+namespace randomly {
+
+struct Particle
+{
+    // precision of the positions and of the noise driving them, picked at build time (EFFECTRENDERER_FLOAT_PARTICLES).
+    // float is plenty for pixel positions, halves the trail memory and doubles the lanes per vector
+#ifdef RANDOMLY_FLOAT_PARTICLES
+    using Scalar = float;
+#else
+    using Scalar = double;
+#endif
+
+    static constexpr int maxLifetime = 8 * 60; // 8 seconds
+    static constexpr qreal pStep = 4 * M_PI;
+
+    // the default trail length, --trail-length picks any power of two in [minTrailLength, maxTrailLength]
+    static constexpr int queueSize = 128;
+    static constexpr int minTrailLength = 16;
+    static constexpr int maxTrailLength = 512;
+
+    // trail positions in whole pixels: the rasterizer truncates them anyway, so this is lossless for the output
+    // and a quarter (double) or half (float) of the memory the trails are streamed from every frame.
+    // limits the resolution to maxCoord in both dimensions, anything beyond would be clamped onto the last pixel
+    using Coord = quint16;
+    static constexpr int maxCoord = 65535;
+};
+
+// structure-of-arrays storage for all particles and their trails
+// every particle gets exactly one new position per frame (either by tick(), move() or reset()),
+// so all trails can share a single ring buffer head instead of one step counter per particle.
+// only the current positions have full precision, the trails keep Particle::Coord copies of them.
+// trails are stored slot-major: all particles' x coordinates of one trail slot are contiguous.
+// instantiated for float and double, the renderer uses Particle::Scalar
+template <typename T>
+class BasicParticleStore
+{
+public:
+    // historySlots are kept on top of the trail, so a trail stays readable through its old head()
+    // for that many advance() calls (the simulation running ahead of the rasterizer)
+    explicit BasicParticleStore(int count = 0, int historySlots = 0, int trailLength = Particle::queueSize);
+
+    int count() const { return m_count; }
+    int trailLength() const { return m_trailLength; }
+    int head() const { return m_head; }
+
+    // the current positions, what the simulation works with
+    const T *x() const { return m_x.data(); }
+    const T *y() const { return m_y.data(); }
+
+    // trail index 0 is the newest position, trailLength() - 1 the oldest one.
+    // the trail as it was when head() returned `head`
+    const Particle::Coord *trailX(int i, int head) const { return m_trailX.data() + std::size_t(slot(i, head)) * m_count; }
+    const Particle::Coord *trailY(int i, int head) const { return m_trailY.data() + std::size_t(slot(i, head)) * m_count; }
+
+    int *lifeTimes() { return m_lifeTime.data(); }
+    int *initialLifeTimes() { return m_initialLifeTime.data(); }
+    const int *lifeTimes() const { return m_lifeTime.data(); }
+    const int *initialLifeTimes() const { return m_initialLifeTime.data(); }
+
+    // fills the whole trail of a particle with the same position
+    void init(int idx, T x, T y, int lifetime);
+    // fills the trails of the particles [begin, end) with their newest position, one slot after the other
+    void fillTrails(int begin, int end);
+
+    // what the store keeps per particle: positions, lifetimes and trail (including the history slots)
+    std::size_t bytesPerParticle() const;
+    std::size_t trailBytesPerParticle() const { return std::size_t(m_slots) * 2 * sizeof(Particle::Coord); }
+
+    // moves the shared head one step forward; afterwards every particle needs a new head position
+    void advance() { m_head = m_head ? (m_head - 1) : m_slots - 1; }
+
+    // all three expect advance() to have been called for this frame.
+    // tick() moves the particles [begin, end) one step into their direction and wraps them around the edges,
+    // particles with a lifetime of 0 are left for reset()
+    void tick(int begin, int end, const T *directions, int w, int h, bool fastTrig = false);
+    void reset(int idx, T x, T y, int lifetime);
+    // sets the newest position, but keeps the lifetime
+    void move(int idx, T x, T y);
+
+private:
+    int slot(int i, int head) const { return (i + head) % m_slots; }
+
+    Particle::Coord *trailX(int i) { return m_trailX.data() + std::size_t(slot(i, m_head)) * m_count; }
+    Particle::Coord *trailY(int i) { return m_trailY.data() + std::size_t(slot(i, m_head)) * m_count; }
+
+    int m_count;
+    int m_trailLength;
+    int m_slots;
+    int m_head = 0;
+
+    std::vector<T> m_x;
+    std::vector<T> m_y;
+    std::vector<Particle::Coord> m_trailX;
+    std::vector<Particle::Coord> m_trailY;
+    std::vector<int> m_lifeTime;
+    std::vector<int> m_initialLifeTime;
+};
+
+extern template class BasicParticleStore<float>;
+extern template class BasicParticleStore<double>;
+
+using ParticleStore = BasicParticleStore<Particle::Scalar>;
+
+} // namespace randomly
+
+#endif // PARTICLESTORE_H
@@ -1,8 +1,10 @@
 #include "previewwindow.h"
 
+#include "livepreview.h"
 #include "renderer.h"
 
 #include <QApplication>
+#include <QMessageBox>
 
 namespace randomly {
 
@@ -23,6 +25,10 @@ PreviewWindow::PreviewWindow(QWidget *parent)
     m_progress->show();
 
     connect(m_recorder->renderer(), &Renderer::frameRendered, this, &PreviewWindow::updateProgress);
+    connect(m_recorder, &Recorder::finished, this, &PreviewWindow::onFinished);
+
+    if (m_recorder->livePreview())
+        connect(m_recorder->livePreview(), &LivePreview::statsUpdated, this, &PreviewWindow::showPreviewStats);
 }
 
 PreviewWindow::~PreviewWindow() {}
@@ -32,6 +38,22 @@ void PreviewWindow::updateProgress()
     m_progress->setValue(m_recorder->renderer()->framesRendered());
 }
 
+void PreviewWindow::showPreviewStats(qreal fps, qreal latencyMs)
+{
+    m_progress->setFormat(QString("%v / %m frames, preview %1 FPS, %2 ms latency").arg(fps, 0, 'f', 1).arg(latencyMs, 0, 'f', 1));
+}
+
+void PreviewWindow::onFinished(bool success)
+{
+    QMessageBox done(m_video);
+
+    done.setText(success ? "rendering done" : "rendering failed");
+    done.setStandardButtons(QMessageBox::Ok);
+
+    done.exec();
+    QApplication::exit(success ? 0 : 1);
+}
+
 void PreviewWindow::resizeEvent(QResizeEvent *event)
 {
     QMainWindow::resizeEvent(event); // default handling
@@ -24,6 +24,8 @@ private:
     QProgressBar *m_progress;
 
     void updateProgress();
+    void showPreviewStats(qreal fps, qreal latencyMs);
+    void onFinished(bool success);
 
     // QWidget interface
 protected:
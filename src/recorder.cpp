@@ -1,17 +1,20 @@
 #include "recorder.h"
 
+#include "livepreview.h"
 #include "renderer.h"
+#include "trace.h"
+#include "y4mwriter.h"
 
 #include <QCommandLineParser>
+#include <QCoreApplication>
 #include <QFile>
-#include <QGuiApplication>
 #include <QLoggingCategory>
 #include <QMediaCaptureSession>
 #include <QMediaFormat>
 #include <QMediaRecorder>
-#include <QMessageBox>
 #include <QThread>
 #include <QVideoFrameInput>
+#include <QVideoSink>
 #include <QVideoWidget>
 
 namespace randomly {
@@ -21,6 +24,8 @@ namespace
 
 Q_LOGGING_CATEGORY(lcRecorder, "randomly.Recorder");
 
+constexpr int videoFrameRate = 60;
+
 inline int operator""_kbps(quint64 v)
 {
     return v * 1000;
@@ -44,7 +49,7 @@ QDebug operator<<(QDebug dbg, RenderInfo &info)
     const QDebugStateSaver saver(dbg);
     dbg.nospace().noquote();
 
-    return dbg << info.framesToRender << " frames@" << info.size.width() << "x" << info.size.height() << "/" << info.seed << ", " << info.particleCount << "(" << info.saveFrames << ")";
+    return dbg << info.framesToRender << " frames from " << info.startFrame << "@" << info.size.width() << "x" << info.size.height() << "/" << info.seed << ", " << info.particleCount << "(" << info.saveFrames << ") on " << info.threads << " threads";
 }
 
 QSize tryParseSize(QString str)
@@ -55,8 +60,135 @@ QSize tryParseSize(QString str)
     }
 
     auto dims = str.split('x');
+    const QSize size(tryConvertInt(dims[0], "width"), tryConvertInt(dims[1], "height"));
+
+    // the trails store their positions as Particle::Coord
+    if (size.width() <= 0 || size.height() <= 0 || size.width() > Particle::maxCoord || size.height() > Particle::maxCoord) {
+        qCWarning(lcRecorder) << "Invalid resolution provided! Width and height have to be from 1 to" << Particle::maxCoord;
+        exit(1);
+    }
+
+    return size;
+}
+
+BlendMode tryParseBlendMode(const QString &str)
+{
+    if (str == "exact")
+        return BlendMode::Exact;
+    if (str == "fast")
+        return BlendMode::Fast;
+
+    qCWarning(lcRecorder) << "Invalid blend mode provided! Expected exact or fast";
+    exit(1);
+}
+
+RenderMode tryParseRenderMode(const QString &str)
+{
+    if (str == "trails")
+        return RenderMode::Trails;
+    if (str == "incremental")
+        return RenderMode::Incremental;
+    if (str == "density")
+        return RenderMode::Density;
+
+    qCWarning(lcRecorder) << "Invalid render mode provided! Expected trails, incremental or density";
+    exit(1);
+}
+
+int tryParseTrailLength(const QString &str)
+{
+    const int length = tryConvertInt(str, "trail length");
+
+    if (length < Particle::minTrailLength || length > Particle::maxTrailLength || (length & (length - 1)) != 0) {
+        qCWarning(lcRecorder) << "Invalid trail length provided! Expected 16, 32, 64, 128, 256 or 512";
+        exit(1);
+    }
+
+    return length;
+}
+
+// frame numbers and counts end up in quint64, where a negative one would wrap around
+quint64 tryParseFrame(const QString &str, const char *name)
+{
+    const int frame = tryConvertInt(str, name);
+
+    if (frame < 0) {
+        qCWarning(lcRecorder) << "Invalid" << name << "provided! Expected 0 or more";
+        exit(1);
+    }
+
+    return frame;
+}
+
+int tryParseTileSize(const QString &str)
+{
+    const int size = tryConvertInt(str, "tile size");
+
+    if (size != 0 && (size < 8 || size > 4096 || (size & (size - 1)) != 0)) {
+        qCWarning(lcRecorder) << "Invalid tile size provided! Expected 0 or a power of two from 8 to 4096";
+        exit(1);
+    }
 
-    return {tryConvertInt(dims[0], "width"), tryConvertInt(dims[1], "height")};
+    return size;
+}
+
+FrameFormat tryParseFrameFormat(const QString &str)
+{
+    if (str == "png")
+        return FrameFormat::Png;
+    if (str == "png-fast")
+        return FrameFormat::PngFast;
+    if (str == "ppm")
+        return FrameFormat::Ppm;
+    if (str == "qoi")
+        return FrameFormat::Qoi;
+    if (str == "raw")
+        return FrameFormat::Raw;
+
+    qCWarning(lcRecorder) << "Invalid frame format provided! Expected png, png-fast, ppm, qoi or raw";
+    exit(1);
+}
+
+WriterOverflow tryParseWriterOverflow(const QString &str)
+{
+    if (str == "block")
+        return WriterOverflow::Block;
+    if (str == "drop")
+        return WriterOverflow::Drop;
+
+    qCWarning(lcRecorder) << "Invalid overflow policy provided! Expected block or drop";
+    exit(1);
+}
+
+// y4m goes to an external encoder through a file, a FIFO or stdout, qt encodes with QMediaRecorder
+bool tryParseY4mOutput(const QString &str, const QString &output)
+{
+    if (str == "auto")
+        return output == "-" || output.endsWith(".y4m");
+    if (str == "y4m")
+        return true;
+    if (str == "qt")
+        return false;
+
+    qCWarning(lcRecorder) << "Invalid output format provided! Expected auto, qt or y4m";
+    exit(1);
+}
+
+// y4m stores I420, so handing it anything else only means converting twice. QMediaRecorder's backends each
+// prefer something else (and convert on the encoder thread whatever they get), so auto keeps ARGB32 there
+PixelFormat tryParsePixelFormat(const QString &str, bool y4m)
+{
+    if (str == "auto")
+        return y4m ? PixelFormat::I420 : PixelFormat::Argb32;
+    if (str == "argb")
+        return PixelFormat::Argb32;
+    if (str == "i420")
+        return PixelFormat::I420;
+    if (str == "nv12" && !y4m)
+        return PixelFormat::Nv12;
+
+    qCWarning(lcRecorder) << "Invalid pixel format provided! Expected auto, argb, i420 or nv12 (not with y4m)";
+    exit(1);
 }
 
 } // namespace
@@ -78,6 +210,12 @@ Recorder::Recorder(QObject *parent)
     QCommandLineOption framesOption({"f", "frames"}, "Number of frames to render\t(default: 60).", "count", "60");
     parser.addOption(framesOption);
 
+    QCommandLineOption startFrameOption("start-frame", "First frame to render, the ones before are only simulated; y4m only, so the shards can be concatenated\t(default: 0).", "frame", "0");
+    parser.addOption(startFrameOption);
+
+    QCommandLineOption endFrameOption("end-frame", "Frame to stop before, overrides --frames.", "frame");
+    parser.addOption(endFrameOption);
+
     QCommandLineOption resolutionOption({"r", "resolution"}, "Video resolution\t\t(default: 1920x1080).", "width>x<height", "1920x1080");
     parser.addOption(resolutionOption);
 
@@ -87,12 +225,79 @@ Recorder::Recorder(QObject *parent)
     QCommandLineOption particleOption({"p", "particles"}, "Number of particles\t(default: 5000).", "count", "5000");
     parser.addOption(particleOption);
 
-    QCommandLineOption outputOption({"o", "output"}, "Output file (default: output.mp4).", "file", "output.mp4");
+    QCommandLineOption trailLengthOption("trail-length", "Positions per trail: 16, 32, 64, 128, 256 or 512\t(default: 128).", "length", "128");
+    parser.addOption(trailLengthOption);
+
+    QCommandLineOption outputOption({"o", "output"}, "Output file, - for stdout (default: output.mp4).", "file", "output.mp4");
     parser.addOption(outputOption);
 
+    QCommandLineOption formatOption("format", "qt (QMediaRecorder) or y4m (raw YUV4MPEG2 for an external encoder); auto picks y4m for - and *.y4m\t(default: auto).", "format", "auto");
+    parser.addOption(formatOption);
+
+    QCommandLineOption pixelFormatOption("pixel-format", "Frames handed to the encoder: argb, i420 or nv12 (converted on the render threads); auto picks i420 for y4m and argb for qt\t(default: auto).", "format", "auto");
+    parser.addOption(pixelFormatOption);
+
     QCommandLineOption saveFramesOption("save-frames", "Save individual frames to ./data/");
     parser.addOption(saveFramesOption);
 
+    QCommandLineOption saveFormatOption("save-format", "Format of the saved frames: png, png-fast (zlib level 1), ppm, qoi or raw (ARGB32)\t(default: png).", "format", "png");
+    parser.addOption(saveFormatOption);
+
+    QCommandLineOption saveQueueOption("save-queue", "Frames that may wait for the background frame writer\t(default: 8).", "count", "8");
+    parser.addOption(saveQueueOption);
+
+    QCommandLineOption saveOverflowOption("save-overflow", "When the frame writer falls behind: block (wait for it) or drop (skip frames)\t(default: block).", "policy", "block");
+    parser.addOption(saveOverflowOption);
+
+    QCommandLineOption threadsOption({"j", "threads"}, "Number of render threads\t(default: all cores).", "count", QString::number(QThread::idealThreadCount()));
+    parser.addOption(threadsOption);
+
+    QCommandLineOption fastTrigOption("fast-trig", "Use vectorized sin/cos for the particle simulation (not bit-identical to std::sin/std::cos).");
+    parser.addOption(fastTrigOption);
+
+    QCommandLineOption flowGridOption("flow-grid", "Approximate the noise with a flow field sampled every <px> pixels\t(default: 0, exact noise).", "px", "0");
+    parser.addOption(flowGridOption);
+
+    QCommandLineOption flowKeyframesOption("flow-keyframes", "Frames between two sampled flow field slices\t(default: 8).", "frames", "8");
+    parser.addOption(flowKeyframesOption);
+
+    QCommandLineOption blendOption("blend", "Trail blending: exact (QColor HSL) or fast (fixed point, at most 1 off per channel)\t(default: exact).", "mode", "exact");
+    parser.addOption(blendOption);
+
+    QCommandLineOption tileSizeOption("tile-size", "Trails mode: sort the samples into <px> sized tiles before blending them, 0 blends in particle order\t(default: 0).", "px", "0");
+    parser.addOption(tileSizeOption);
+
+    QCommandLineOption renderModeOption("render-mode", "trails (redraw all trails), incremental (fade a persistent buffer, only draw new positions) or density (accumulate coverage, then colour each pixel once)\t(default: trails).", "mode", "trails");
+    parser.addOption(renderModeOption);
+
+    QCommandLineOption compareTrailsOption("compare-trails", "In incremental or density mode, report the difference to the trails mode for every frame.");
+    parser.addOption(compareTrailsOption);
+
+    QCommandLineOption verifyOption("verify", "Render every frame with the reference kernels as well, report the differences and write a hash manifest to <file>.", "file");
+    parser.addOption(verifyOption);
+
+    QCommandLineOption checkOption("check", "Compare every frame's hash against a manifest written by --verify, fail on any mismatch.", "file");
+    parser.addOption(checkOption);
+
+    QCommandLineOption recordTrajectoryOption("record-trajectory", "Record the simulated particles to <file>, for re-rendering them with --replay-trajectory.", "file");
+    parser.addOption(recordTrajectoryOption);
+
+    QCommandLineOption replayTrajectoryOption("replay-trajectory", "Take the particles from a recorded <file> instead of simulating them, its seed and particle count override -s and -p.", "file");
+    parser.addOption(replayTrajectoryOption);
+
+    QCommandLineOption traceOption("trace", "Time the render stages and write a Chrome/Perfetto trace to <file>, implies --profile.", "file");
+    parser.addOption(traceOption);
+
+    QCommandLineOption profileOption("profile", "Time the render stages and log min/p50/p99 per stage at the end.");
+    parser.addOption(profileOption);
+
+    QCommandLineOption livePreviewOption("live-preview", "Preview a separate render at 1/<n> of the resolution (and 1/n^2 of the particles) at the display's refresh rate instead of the encoded frames, on a quarter of --threads\t(default: 0, off).", "n", "0");
+    parser.addOption(livePreviewOption);
+
+    // main() already picked the application type based on this, it's only here for --help and so the parser accepts it
+    QCommandLineOption headlessOption("headless", "Render without any windows, report progress on stderr and exit with a status code.");
+    parser.addOption(headlessOption);
+
 
     parser.process(QCoreApplication::arguments());
 
@@ -100,26 +305,144 @@ Recorder::Recorder(QObject *parent)
 
     info.size = tryParseSize(parser.value(resolutionOption));
     info.particleCount = tryConvertInt(parser.value(particleOption), "particle count");
-    info.framesToRender = tryConvertInt(parser.value(framesOption), "frame count");
+    info.trailLength = tryParseTrailLength(parser.value(trailLengthOption));
+    info.framesToRender = tryParseFrame(parser.value(framesOption), "frame count");
+    info.startFrame = tryParseFrame(parser.value(startFrameOption), "start frame");
+
+    if (parser.isSet(endFrameOption)) {
+        const quint64 endFrame = tryParseFrame(parser.value(endFrameOption), "end frame");
+
+        if (endFrame <= info.startFrame) {
+            qCWarning(lcRecorder) << "--end-frame has to be after --start-frame";
+            exit(1);
+        }
+
+        info.framesToRender = endFrame - info.startFrame;
+    }
     info.seed = tryConvertInt(parser.value(seedOption), "seed");
     info.saveFrames = parser.isSet(saveFramesOption);
+    info.saveFormat = tryParseFrameFormat(parser.value(saveFormatOption));
+    info.saveQueue = tryConvertInt(parser.value(saveQueueOption), "frame writer queue");
+    info.saveOverflow = tryParseWriterOverflow(parser.value(saveOverflowOption));
+    info.threads = tryConvertInt(parser.value(threadsOption), "thread count");
+    info.fastTrig = parser.isSet(fastTrigOption);
+    info.flowGrid = tryConvertInt(parser.value(flowGridOption), "flow field grid");
+    info.flowKeyframes = tryConvertInt(parser.value(flowKeyframesOption), "flow field keyframe interval");
+    info.blendMode = tryParseBlendMode(parser.value(blendOption));
+    info.tileSize = tryParseTileSize(parser.value(tileSizeOption));
+    info.renderMode = tryParseRenderMode(parser.value(renderModeOption));
+    info.compareTrails = parser.isSet(compareTrailsOption);
+
+    if (parser.isSet(verifyOption) && parser.isSet(checkOption)) {
+        qCWarning(lcRecorder) << "--verify and --check can't be combined";
+        exit(1);
+    }
+
+    if (parser.isSet(verifyOption)) {
+        info.verifyMode = VerifyMode::Verify;
+        info.manifest = parser.value(verifyOption);
+    } else if (parser.isSet(checkOption)) {
+        info.verifyMode = VerifyMode::Check;
+        info.manifest = parser.value(checkOption);
+    }
+
+    if (parser.isSet(recordTrajectoryOption) && parser.isSet(replayTrajectoryOption)) {
+        qCWarning(lcRecorder) << "--record-trajectory and --replay-trajectory can't be combined";
+        exit(1);
+    }
+
+    info.recordTrajectory = parser.value(recordTrajectoryOption);
+    info.replayTrajectory = parser.value(replayTrajectoryOption);
+
+    if (!info.replayTrajectory.isEmpty()) {
+        const auto header = TrajectoryReader::readHeader(info.replayTrajectory);
+        if (!header)
+            exit(1);
+
+        if (info.startFrame + info.framesToRender > header->frameCount) {
+            qCWarning(lcRecorder) << info.replayTrajectory << "only has" << header->frameCount << "frames";
+            exit(1);
+        }
+
+        if (header->trailLength != quint32(info.trailLength)) {
+            qCWarning(lcRecorder) << info.replayTrajectory << "was recorded with --trail-length" << header->trailLength;
+            exit(1);
+        }
+
+        info.seed = header->seed;
+        info.particleCount = header->particleCount;
+    }
+
+    const auto outputName = parser.value(outputOption);
+    const bool y4m = tryParseY4mOutput(parser.value(formatOption), outputName);
+    info.pixelFormat = tryParsePixelFormat(parser.value(pixelFormatOption), y4m);
+
+    // QMediaRecorder would encode every shard into a container of its own, which no `cat` puts back together
+    if (info.startFrame > 0 && !y4m) {
+        qCWarning(lcRecorder) << "--start-frame needs the y4m output, QMediaRecorder shards can't be concatenated";
+        exit(1);
+    }
 
     qCInfo(lcRecorder).noquote() << info << "->" << parser.value(outputOption);
 
-    m_output = new QFile(parser.value(outputOption), this);
+    m_tracePath = parser.value(traceOption);
+    trace::setEnabled(parser.isSet(profileOption) || !m_tracePath.isEmpty());
+
+    // the headless runner never asks for a preview, so there it's simply never started
+    const int livePreviewDivisor = tryConvertInt(parser.value(livePreviewOption), "live preview divisor");
+    if (livePreviewDivisor > 0) {
+        // the trace doesn't know which renderer a thread belongs to
+        if (trace::isEnabled()) {
+            qCWarning(lcRecorder) << "--live-preview can't be combined with --profile or --trace";
+            exit(1);
+        }
+
+        m_livePreview = new LivePreview(info, livePreviewDivisor, this);
+
+        // --threads covers both renders, only with a single thread they have to share it
+        info.threads = std::max(info.threads - m_livePreview->threads(), 1);
+        qCInfo(lcRecorder) << "leaving" << info.threads << "threads to the full render";
+    }
+
+    m_output = new QFile(outputName, this);
+
+    // the renderer runs its own simulation and rasterizer threads, this thread only hands the frames to the encoder
+    m_renderer = new Renderer(this, info);
+
+    const bool opened = outputName == "-" ? m_output->open(stdout, QFile::WriteOnly) : m_output->open(QFile::WriteOnly);
+    if (!opened) {
+        qCWarning(lcRecorder) << "Could not open" << outputName << m_output->errorString();
+        m_failed = true;
+    }
+
+    if (y4m) {
+        // only the first shard gets the header, so `cat` puts the shards together into the same stream a full run writes
+        m_y4m = std::make_unique<Y4mWriter>(m_output, info.size, videoFrameRate, info.threads, info.startFrame == 0);
+        qCInfo(lcRecorder) << "streaming y4m to" << outputName;
+    } else {
+        setupMediaRecorder();
+    }
+
+    // a new frame might allow us to send something (QMediaRecorder additionally wakes us up once its encoder is ready again)
+    connect(m_renderer, &Renderer::frameRendered, this, &Recorder::sendFrames);
 
-    // parent = nullptr so I can move the renderer between threads
-    m_renderer = new Renderer(nullptr, this, info);
+    if (!y4m)
+        m_recorder->record();
+    m_renderer->start();
 
-    QThread *renderThread = new QThread(this);
+    // queued, so whoever constructed us had a chance to connect to finished()
+    if (m_renderer->targetFrames() == 0)
+        QMetaObject::invokeMethod(this, &Recorder::stop, Qt::QueuedConnection);
+}
 
-    m_renderer->moveToThread(renderThread);
-    m_output->open(QFile::WriteOnly);
+Recorder::~Recorder() = default;
 
+void Recorder::setupMediaRecorder()
+{
     m_recorder->setVideoBitRate(25000_kbps);
     m_recorder->setAudioBitRate(25000_kbps);
 
-    m_recorder->setVideoFrameRate(60);
+    m_recorder->setVideoFrameRate(videoFrameRate);
     m_recorder->setOutputDevice(m_output);
     m_recorder->setQuality(QMediaRecorder::VeryHighQuality); // doesn't seem to have any effect
     // m_recorder->setEncodingMode(QMediaRecorder::TwoPassEncoding); // seems to not change anything either
@@ -136,13 +459,14 @@ Recorder::Recorder(QObject *parent)
     m_session->setRecorder(m_recorder);
     m_session->setVideoFrameInput(m_input);
 
-    connect(m_input, &QVideoFrameInput::readyToSendVideoFrame, this, [this] () {m_renderer->render(); }); // doesn't work with `m_renderer, &Renderer::render`; might be because m_renderer lives in a different thread?
-    connect(m_renderer, &Renderer::frameRendered, m_input, &QVideoFrameInput::sendVideoFrame);
-    connect(m_recorder, &QMediaRecorder::errorOccurred, [] (QMediaRecorder::Error error, const QString &errorString) { qCWarning(lcRecorder) << error << errorString; });
+    // the encoder got ready again, which might allow us to send something
+    connect(m_input, &QVideoFrameInput::readyToSendVideoFrame, this, &Recorder::sendFrames);
+    connect(m_recorder, &QMediaRecorder::errorOccurred, this, [this] (QMediaRecorder::Error error, const QString &errorString) {
+        qCWarning(lcRecorder) << error << errorString;
+        m_failed = true;
+    });
     connect(m_recorder, &QMediaRecorder::recorderStateChanged, this, &Recorder::onMediaRecorderStateChanged);
 
-    m_recorder->record();
-
     qCInfo(lcRecorder) << "FPS:" << m_recorder->videoFrameRate() << "bps:" << m_recorder->videoBitRate();
     qCInfo(lcRecorder) << "saving to" << m_output->fileName() << "type" << m_recorder->mediaFormat().fileFormat() << "using codec" << m_recorder->mediaFormat().videoCodec();
 }
@@ -151,29 +475,95 @@ void Recorder::setPreviewOutput(QVideoWidget *widget)
 {
     qCInfo(lcRecorder) << "new preview:" << widget;
 
+    if (m_livePreview) {
+        m_livePreview->start(widget->videoSink());
+        return;
+    }
+
     m_preview = widget;
     m_session->setVideoOutput(widget);
 }
 
+void Recorder::sendFrames()
+{
+    while (!m_stopped && m_framesSent < quint64(m_renderer->targetFrames())) {
+        if (!m_pendingFrame.isValid() && !m_renderer->takeFrame(m_pendingFrame))
+            return;
+
+        const trace::ScopedTimer timer(trace::Stage::Encode);
+
+        if (m_y4m) {
+            if (!m_y4m->write(m_pendingFrame)) {
+                qCWarning(lcRecorder) << "Writing frame" << m_framesSent << "failed:" << m_output->errorString();
+                m_failed = true;
+                stop();
+                return;
+            }
+
+            // the capture session doesn't see these frames, so feed the preview directly
+            if (m_preview)
+                m_preview->videoSink()->setVideoFrame(m_pendingFrame);
+        } else if (!m_input->sendVideoFrame(m_pendingFrame)) {
+            // the encoder's queue is full, we'll get readyToSendVideoFrame once there's room again
+            return;
+        }
+
+        m_pendingFrame = {};
+
+        if (++m_framesSent == quint64(m_renderer->targetFrames()))
+            stop();
+    }
+}
+
 void Recorder::stop()
 {
-    m_recorder->stop();
+    if (m_stopped)
+        return;
+
+    m_stopped = true;
+
+    if (m_y4m)
+        finish();
+    else
+        m_recorder->stop();
 }
 
-void Recorder::onMediaRecorderStateChanged(QMediaRecorder::RecorderState state)
+void Recorder::finish()
 {
-    qCInfo(lcRecorder) << "Recorder state changed!" << state;
+    m_output->close();
 
-    if (state == QMediaRecorder::StoppedState) {
-        m_output->close();
-        QMessageBox done(m_preview);
+    // after a failure nobody takes the remaining frames, which would keep the rasterizer blocked
+    if (m_framesSent < quint64(m_renderer->targetFrames()))
+        m_renderer->stop();
+
+    // the rasterizer and the frame writer's threads may still be recording events, the trace can only be read once they're done
+    m_renderer->wait();
+
+    if (trace::isEnabled()) {
+        trace::printSummary();
+
+        if (!m_tracePath.isEmpty())
+            trace::writeChromeTrace(m_tracePath);
+    }
 
-        done.setText("rendering done");
-        done.setStandardButtons(QMessageBox::Ok);
+    // wait() let the rasterizer finish the verifier, so the manifest is written and the last frame is compared
+    if (!m_renderer->verificationPassed())
+        m_failed = true;
 
-        done.exec();
-        QGuiApplication::exit();
+    if (m_framesSent < quint64(m_renderer->targetFrames())) {
+        qCWarning(lcRecorder) << "Recorder stopped after" << m_framesSent << "of" << m_renderer->targetFrames() << "frames";
+        m_failed = true;
     }
+
+    emit finished(!m_failed);
+}
+
+void Recorder::onMediaRecorderStateChanged(QMediaRecorder::RecorderState state)
+{
+    qCInfo(lcRecorder) << "Recorder state changed!" << state;
+
+    if (state == QMediaRecorder::StoppedState)
+        finish();
 }
 
 } // namespace randomly
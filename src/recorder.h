@@ -5,6 +5,8 @@
 #include <QVideoFrame>
 #include <QMediaRecorder>
 
+#include <memory>
+
 class QFile;
 class QMediaCaptureSession;
 class QVideoFrameInput;
@@ -12,28 +14,49 @@ class QVideoWidget;
 
 namespace randomly {
 
+class LivePreview;
 class Renderer;
+class Y4mWriter;
 
 class Recorder : public QObject
 {
     Q_OBJECT
 public:
     explicit Recorder(QObject *parent = nullptr);
+    ~Recorder();
 
+    // shows the encoded frames, or the live preview's with --live-preview
     void setPreviewOutput(QVideoWidget *widget);
 
+    void sendFrames();
     void stop();
     void onMediaRecorderStateChanged(QMediaRecorder::RecorderState state);
     Renderer *renderer() { return m_renderer; }
+    LivePreview *livePreview() { return m_livePreview; } // null without --live-preview
+
+    quint64 framesSent() const { return m_framesSent; }
+
+signals:
+    // the output file is closed, success is false if anything went wrong on the way
+    void finished(bool success);
 
 private:
+    void setupMediaRecorder();
+    void finish();
+
     QVideoWidget *m_preview = nullptr;
+    LivePreview *m_livePreview = nullptr;
 
     QVideoFrameInput *m_input;
-    QVideoFrame m_frame;
+    QVideoFrame m_pendingFrame; // taken from the renderer, but not yet accepted by the encoder
+    quint64 m_framesSent = 0;
     QMediaCaptureSession *m_session;
     QMediaRecorder *m_recorder;
     QFile *m_output;
+    std::unique_ptr<Y4mWriter> m_y4m; // replaces QMediaRecorder with --format y4m
+    QString m_tracePath;
+    bool m_stopped = false;
+    bool m_failed = false;
 
     Renderer *m_renderer;
 };
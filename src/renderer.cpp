@@ -1,11 +1,15 @@
 #include "renderer.h"
-#include "recorder.h"
+#include "parallel.h"
+#include "trace.h"
 
 #include <QElapsedTimer>
 #include <QLoggingCategory>
 #include <QPainter>
-#include <QRandomGenerator>
-#include <qthread.h>
+#include <QThread>
+#include <QThreadPool>
+
+#include <bit>
+#include <cmath>
 
 namespace randomly {
 
@@ -14,51 +18,65 @@ using namespace std::chrono_literals;
 namespace
 {
 
-constexpr int OFFSET_RED   = 2;
-constexpr int OFFSET_GREEN = 1;
-constexpr int OFFSET_BLUE  = 0;
+// only every n-th particle is compared against the exact noise when using the flow field
+constexpr int flowErrorStride = 64;
 
-inline qreal lerp(qreal a, qreal b, qreal t)
-{
-    return (b - a) * t + a;
-}
+// samples a band collects before blending them tile by tile, bounds the bins to a few MB per thread
+constexpr int tileBatchSamples = 1 << 18;
+
+// steps of the density mode's tone map, fine enough that a single sample of the oldest visible age still shows
+constexpr int toneMapLevels = 4096;
 
-// 0 is max foreground, Particle::queueSize is all background
+// below this, a pixel is the particle colour anyway. keeps the density mode's products out of the denormals
+constexpr float minTransmittance = 1e-30f;
+
+// 0 is max foreground, Length is all background
+template <int Length>
 int getAgeInOldTrail(int i, int offset, int len)
 {
     // if the current position is within the first half (len >> 1 ~ len/2)
     if (i - offset < (len >> 1)) {
-        return Particle::queueSize - (i - offset);
+        return Length - (i - offset);
     }
 
     // otherwise, use normal fading
     return i;
 }
 
-inline QPoint clampPositionToImage(QPointF p, int w, int h)
+// a trail position wrapped around at the right or bottom edge lies exactly on it
+inline QPoint clampPositionToImage(int x, int y, int w, int h)
 {
     return {
-        std::min(int(p.x()), w - 1),
-        std::min(int(p.y()), h - 1)
+        std::min(x, w - 1),
+        std::min(y, h - 1)
     };
 }
 
+// difference between the directions resulting from two noise values
+qreal angularError(qreal a, qreal b)
+{
+    const auto d = std::fmod(std::abs(a - b) * Particle::pStep, 2 * M_PI);
+    return std::min(d, 2 * M_PI - d);
+}
+
+// Length is the trail length, as a constant the divisions by it become shifts and the kernels' loops get fixed bounds
+template <int Length>
 int getAgeOfPosition(int i, int lifeTime, int initialLifeTime)
 {
     if (lifeTime + i > initialLifeTime) { // previous generation
-        // Particle::queueSize - (initialLifeTime - lifeTime) old generation elements
+        // Length - (initialLifeTime - lifeTime) old generation elements
         const auto offset = initialLifeTime - lifeTime;
-        const int len = Particle::queueSize - offset;
+        const int len = Length - offset;
 
-        return getAgeInOldTrail(i, offset, len);
+        return getAgeInOldTrail<Length>(i, offset, len);
     }
 
     // current generation
-    if ((lifeTime + i) < (Particle::queueSize >> 1)) { // nearing the end of the life cycle
-        // Particle::queueSize - lifeTime elements in this segment
-        const int len = Particle::queueSize - lifeTime;
-        // if (len < Particle::queueSize >> 1) // less than half the elements are fading
-        // return Particle::queueSize - i - lifeTime;
+    if ((lifeTime + i) < (Length >> 1)) { // nearing the end of the life cycle
+        // Length - lifeTime elements in this segment
+        const int len = Length - lifeTime;
+        // if (len < Length >> 1) // less than half the elements are fading
+        // return Length - i - lifeTime;
         // return i + len;
         return len - i - lifeTime;
     }
@@ -66,180 +84,789 @@ int getAgeOfPosition(int i, int lifeTime, int initialLifeTime)
     return i;
 }
 
+// calls fn with the trail length as std::integral_constant, every supported length gets its own kernels
+template <typename F>
+void dispatchTrailLength(int length, F &&fn)
+{
+    static_assert(Particle::minTrailLength == 16 && Particle::maxTrailLength == 512);
+
+    switch (length) {
+    case 16:  return fn(std::integral_constant<int, 16>());
+    case 32:  return fn(std::integral_constant<int, 32>());
+    case 64:  return fn(std::integral_constant<int, 64>());
+    case 128: return fn(std::integral_constant<int, 128>());
+    case 256: return fn(std::integral_constant<int, 256>());
+    case 512: return fn(std::integral_constant<int, 512>());
+    }
+
+    Q_UNREACHABLE();
+}
+
 } // namespace
 
 Q_LOGGING_CATEGORY(lcRenderer, "randomly.Renderer")
+// one line per frame adds up at high frame rates, enable with QT_LOGGING_RULES="randomly.Renderer.frames.info=true"
+Q_LOGGING_CATEGORY(lcRendererFrames, "randomly.Renderer.frames", QtWarningMsg)
 
-Renderer::Renderer(QObject *parent, Recorder *recorder, const RenderInfo &info)
+namespace
+{
+
+const QColor bg(0xff2d2d2d);
+const QColor particleClr(0xff700080);
+
+} // namespace
+
+Renderer::Renderer(QObject *parent, const RenderInfo &info)
     : QObject{parent}
-    , m_recorder(recorder)
     , m_size(info.size)
     , m_noise(PerlinNoise(info.seed))
+    , m_startFrame(info.startFrame)
     , framesToRender(info.framesToRender)
-    , m_saveFrames(info.saveFrames)
-    , m_rng(new QRandomGenerator(info.seed))
+    , m_frameWriter(info.saveFrames ? std::make_unique<FrameWriter>("data", info.saveFormat, info.saveOverflow, info.threads, info.saveQueue) : nullptr)
+    , m_rng(info.seed)
+    , m_trailLength(info.trailLength)
+    , m_particles(info.particleCount, frameStateCount, m_trailLength)
+    , m_trajectoryWriter(!info.recordTrajectory.isEmpty() ? std::make_unique<TrajectoryWriter>(info.recordTrajectory, info.size, info.seed, info.particleCount, info.trailLength) : nullptr)
+    , m_trajectoryReader(!info.replayTrajectory.isEmpty() ? std::make_unique<TrajectoryReader>(info.replayTrajectory, info.size) : nullptr)
+    , m_threads(std::max(info.threads, 1))
+    , m_pool(new QThreadPool(this))
+    , m_fastTrig(info.fastTrig)
+    , m_scalarNoise(info.scalarNoise)
+    , m_directions(info.particleCount)
+    , m_expired(m_threads)
+    , m_sampledFlowError(m_threads, 0)
+    , m_blendMode(info.blendMode)
+    , m_blender(particleClr, m_trailLength)
+    , m_tileShift(info.tileSize > 0 ? std::countr_zero(uint(info.tileSize)) : 0)
+    , m_tiles(m_tileShift ? m_threads : 0)
+    , m_renderMode(info.renderMode)
+    , m_fadeKeep(qRound(std::pow(256., -1. / m_trailLength) * 32768))
+    , m_compareTrails(info.compareTrails && info.renderMode != RenderMode::Trails)
+    , m_pixelFormat(info.pixelFormat)
+    , m_framePool(FramePool::create(m_size, (m_pixelFormat == PixelFormat::Argb32 ? info.renderQueue + encoderQueueDepth + 2 : 1)
+                                                + (m_frameWriter ? m_frameWriter->queueDepth() : 0)))
+    , m_yuvPool(m_pixelFormat != PixelFormat::Argb32 ? FramePool::create(m_size, info.renderQueue + encoderQueueDepth + 2, m_pixelFormat) : nullptr)
+    , m_states(frameStateCount)
+    , m_freeStates(frameStateCount)
+    , m_simulated(simulationQueueDepth)
+    , m_rendered(info.renderQueue)
 {
+    m_pool->setMaxThreadCount(m_threads);
+
+    // a replay doesn't sample the noise at all
+    if (info.flowGrid > 0 && !m_trajectoryReader) {
+        m_flowField = std::make_unique<FlowField>(m_noise, m_size, scale, scale, info.flowGrid, info.flowKeyframes);
+        qCInfo(lcRenderer) << "using a flow field with" << info.flowGrid << "px cells and a keyframe every" << info.flowKeyframes << "frames";
+    }
+
+    if (m_tileShift)
+        qCInfo(lcRenderer) << "binning the trail samples into" << info.tileSize << "px tiles";
+
+    if (m_renderMode == RenderMode::Incremental) {
+        const auto pixelCount = std::size_t(m_size.width()) * m_size.height();
+
+        m_accumulation[0].assign(pixelCount, bg.red()   << 8);
+        m_accumulation[1].assign(pixelCount, bg.green() << 8);
+        m_accumulation[2].assign(pixelCount, bg.blue()  << 8);
+    }
+
+    if (m_renderMode == RenderMode::Density) {
+        m_transmittance.resize(std::size_t(m_size.width()) * m_size.height());
+
+        for (int age = 0; age <= m_trailLength; ++age)
+            m_ageTransmittance[age] = float(age) / m_trailLength;
+
+        // the background is the same everywhere, so the colour only depends on the transmittance
+        m_toneMap.resize(toneMapLevels + 1);
+        for (int level = 0; level <= toneMapLevels; ++level) {
+            QRgb pixel = bg.rgba();
+            m_blender.mix(pixel, qreal(level) / toneMapLevels);
+            m_toneMap[level] = pixel;
+        }
+    }
+
+    if (info.verifyMode != VerifyMode::Off)
+        m_verifier = std::make_unique<FrameVerifier>(info.verifyMode, info.manifest, info);
+
+    for (auto &state: m_states) {
+        state.lifeTimes.resize(info.particleCount);
+        state.initialLifeTimes.resize(info.particleCount);
+    }
+
     m_renderTimer.start();
 
-    m_particles.reserve(info.particleCount);
+    // simulating instead would quietly render a different animation
+    if (m_trajectoryReader && (!m_trajectoryReader->isValid() || m_trajectoryReader->header().particleCount != quint32(info.particleCount)
+                               || m_trajectoryReader->header().trailLength != quint32(m_trailLength)))
+        qCFatal(lcRenderer) << "can't replay" << info.replayTrajectory << "with" << info.particleCount << "particles and a trail length of" << m_trailLength;
+
+    if (m_trajectoryReader) {
+        if (!m_trajectoryReader->replay(0, m_particles))
+            qCFatal(lcRenderer) << "replaying" << info.replayTrajectory << "failed";
+    } else {
+        m_generations.assign(info.particleCount, 0);
+
+        // every particle's numbers only depend on its index, so the chunks don't change them
+        parallelFor(m_pool, info.particleCount, m_threads, [this] (int begin, int end, int) {
+            for (int i = begin; i < end; ++i) {
+                const auto p = makeParticle(i);
+                m_particles.reset(i, p.first.x(), p.first.y(), p.second);
+            }
+
+            m_particles.fillTrails(begin, end);
+        });
+    }
+
+    if (m_trajectoryWriter)
+        m_trajectoryWriter->write(m_particles);
+
+    qCInfo(lcRenderer) << "particles initialized in" << m_renderTimer.elapsed() << "ms on" << m_threads << "threads";
+
+    // the store plus the direction, the rng generation and the lifetimes copied into every frame state
+    const auto bytesPerParticle = m_particles.bytesPerParticle() + sizeof(Particle::Scalar) + sizeof(quint32) + frameStateCount * 2 * sizeof(int);
+    qCInfo(lcRenderer).nospace() << "particles take " << bytesPerParticle << " bytes each (" << m_particles.trailBytesPerParticle() << " of them trail), "
+                                 << ((bytesPerParticle * m_particles.count()) >> 20) << " MiB in total";
+}
 
-    for (int i = 0; i < info.particleCount; ++i)
-        m_particles.emplaceBack(makeParticle());
+Renderer::~Renderer()
+{
+    stop();
+    wait();
+}
 
-    qCInfo(lcRenderer) << "particles initialized in" << m_renderTimer.elapsed() << "ms";
+void Renderer::start()
+{
+    for (auto &state: m_states) {
+        auto s = &state;
+        m_freeStates.tryPush(s);
+    }
 
     m_renderTimer.start();
+
+    m_simulationThread.reset(QThread::create([this] { simulationLoop(); }));
+    m_rasterizerThread.reset(QThread::create([this] { rasterizerLoop(); }));
+
+    m_simulationThread->setObjectName("simulation");
+    m_rasterizerThread->setObjectName("rasterizer");
+
+    m_simulationThread->start();
+    m_rasterizerThread->start();
+}
+
+void Renderer::stop()
+{
+    m_freeStates.close();
+    m_simulated.close();
+    m_rendered.close();
+}
+
+void Renderer::wait()
+{
+    for (const auto &thread: {m_simulationThread.get(), m_rasterizerThread.get()}) {
+        if (thread)
+            thread->wait();
+    }
+}
+
+const char *renderModeName(RenderMode mode)
+{
+    switch (mode) {
+    case RenderMode::Trails:
+        return "trails";
+    case RenderMode::Incremental:
+        return "incremental";
+    case RenderMode::Density:
+        return "density";
+    }
+
+    return "";
+}
+
+bool Renderer::takeFrame(QVideoFrame &frame)
+{
+    qint64 age;
+    return takeFrame(frame, age);
+}
+
+bool Renderer::takeFrame(QVideoFrame &frame, qint64 &age)
+{
+    RenderedFrame rendered;
+    if (!m_rendered.tryPop(rendered))
+        return false;
+
+    frame = std::move(rendered.frame);
+    age = m_renderTimer.nsecsElapsed() - rendered.simulatedAt;
+    return true;
+}
+
+void Renderer::simulationLoop()
+{
+    fastForward();
+
+    QElapsedTimer timing;
+    const auto endFrame = m_startFrame + framesToRender;
+
+    for (quint64 frame = m_startFrame; frame < endFrame; ++frame) {
+        timing.start();
+
+        FrameState *state = nullptr;
+        if (!m_freeStates.pop(state))
+            return;
+
+        m_stats.simulationStalled += timing.nsecsElapsed();
+        timing.start();
+
+        snapshot(frame, *state);
+        state->simulatedAt = m_renderTimer.nsecsElapsed();
+
+        m_stats.simulating += timing.nsecsElapsed();
+        timing.start();
+
+        if (!m_simulated.push(state))
+            return;
+
+        m_stats.simulationStalled += timing.nsecsElapsed();
+
+        // nobody is interested in what comes after the last frame
+        if (frame + 1 == endFrame) {
+            if (m_trajectoryWriter)
+                m_trajectoryWriter->finish();
+            break;
+        }
+
+        timing.start();
+
+        step();
+
+        m_stats.simulating += timing.nsecsElapsed();
+    }
 }
 
-void Renderer::render()
+void Renderer::fastForward()
 {
-    if (currentFrame == framesToRender) {
-        m_recorder->stop();
-        qCInfo(lcRenderer) << "Rendering done!" << m_renderTimer.elapsed() << "ms total";
+    if (m_startFrame == 0)
         return;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // runs before the first state is queued, so the rasterizer doesn't touch m_accumulation yet
+    FrameState state;
+    if (m_renderMode == RenderMode::Incremental) {
+        state.lifeTimes.resize(m_particles.count());
+        state.initialLifeTimes.resize(m_particles.count());
     }
 
-    qCInfo(lcRenderer) << "rendering" << currentFrame << "/" << framesToRender;
+    for (quint64 frame = 0; frame < m_startFrame; ++frame) {
+        // every skipped frame leaves its splats in the persistent buffer
+        if (m_renderMode == RenderMode::Incremental) {
+            snapshot(frame, state);
+            rasterizeIncremental(state, nullptr);
+        }
+
+        step();
+    }
+
+    qCInfo(lcRenderer) << "fast-forwarded to frame" << m_startFrame << "in" << timer.elapsed() << "ms";
+}
+
+void Renderer::snapshot(quint64 frame, FrameState &state) const
+{
+    // the positions stay in m_particles, thanks to its history slots they are still there when the rasterizer gets to them
+    state.frame = frame;
+    state.head = m_particles.head();
+    std::copy_n(m_particles.lifeTimes(), m_particles.count(), state.lifeTimes.begin());
+    std::copy_n(m_particles.initialLifeTimes(), m_particles.count(), state.initialLifeTimes.begin());
+}
+
+void Renderer::step()
+{
+    if (!m_trajectoryReader)
+        updateParticles();
+    else if (!m_trajectoryReader->replay(m_simulationFrame + 1, m_particles))
+        qCFatal(lcRenderer) << "replaying frame" << m_simulationFrame + 1 << "failed";
 
+    if (m_trajectoryWriter)
+        m_trajectoryWriter->write(m_particles);
+
+    ++m_simulationFrame;
+    m_z += scale;
+}
+
+void Renderer::rasterizerLoop()
+{
     QElapsedTimer timing;
-    timing.start();
 
-    QImage img(m_size.width(), m_size.height(), QImage::Format::Format_ARGB32);
+    for (quint64 frame = 0; frame < framesToRender; ++frame) {
+        timing.start();
+        m_stats.simulatedQueued += m_simulated.size();
+
+        FrameState *state = nullptr;
+        if (!m_simulated.pop(state))
+            return;
+
+        m_stats.rasterizerStarved += timing.nsecsElapsed();
+
+        qCInfo(lcRendererFrames) << "rendering frame" << state->frame << "(" << frame + 1 << "/" << framesToRender << ")";
+        timing.start();
+
+        RenderedFrame rendered{rasterize(*state), state->simulatedAt};
+        m_freeStates.tryPush(state); // there's always room for all states
 
-    static const QColor bg(0xff2d2d2d);
-    static const auto particleClr = QColor(0xff700080).toHsl();
+        const auto elapsed = timing.nsecsElapsed();
+        m_stats.rasterizing += elapsed;
 
-    img.fill(bg);
+        qCInfo(lcRendererFrames) << "rendering done in" << elapsed / 1000000 << "ms (" << (qreal(1000000000) / elapsed) << "FPS)";
+
+        timing.start();
+        m_stats.renderedQueued += m_rendered.size();
+
+        if (!m_rendered.push(std::move(rendered)))
+            return;
+
+        m_stats.rasterizerStalled += timing.nsecsElapsed();
+
+        ++m_framesRendered;
+        emit frameRendered();
+    }
+
+    reportStats();
+}
+
+QVideoFrame Renderer::rasterize(const FrameState &state)
+{
+    PooledFrame frame;
+
+    {
+        const trace::ScopedTimer timer(trace::Stage::Wrap);
+        frame = m_framePool->acquire();
+
+        // properly init the frame
+        const quint64 frameTime = state.frame * frameDelay;
+        frame.frame.setStartTime(frameTime);
+        frame.frame.setEndTime(frameTime + frameDelay);
+    }
+
+    auto &img = frame.image;
 
     // I believe technically a QByteArray would be correct, but using a raw pointer halves rendering time
     // most likely because the QByteArray spends time checking if it needs to be detached
-    auto imgData = img.bits();
+    const auto pixels = reinterpret_cast<QRgb *>(img.bits());
+
+    if (m_renderMode == RenderMode::Incremental) {
+        rasterizeIncremental(state, pixels);
+
+        if (m_compareTrails)
+            compareWithTrails(state, img);
+    } else if (m_renderMode == RenderMode::Density) {
+        rasterizeDensity(state, pixels);
+
+        if (m_compareTrails)
+            compareWithTrails(state, img);
+    } else {
+        {
+            const trace::ScopedTimer timer(trace::Stage::Clear);
+            img.fill(bg);
+        }
 
-    for (auto &p: m_particles) {
-        auto positions = p.positions();
+        rasterizeTrails(state, pixels);
+    }
 
-        for (int i = positions.length() - 1; i >= 0; --i) {
-            int age = getAgeOfPosition(i, p.lifeTime(), p.initialLifeTime());
+    if (m_verifier)
+        m_verifier->process(state.frame, img);
 
-            const auto f = age * Particle::queueSizeInv;
-            const auto pos = positions.get(i);
+    // the writer holds on to the frame, so there's no copy and the buffer stays out of the pool until it's saved
+    if (m_frameWriter)
+        m_frameWriter->write(state.frame, frame.frame, img);
 
-            const auto imgPos = clampPositionToImage(pos, m_size.width(), m_size.height());
-            const int index0 = (imgPos.x() + imgPos.y() * img.width()) * 4;
+    if (m_yuvPool)
+        return convert(state, img);
 
-            auto bgClr = QColor {
-                uchar(imgData[index0 + OFFSET_RED  ]),
-                uchar(imgData[index0 + OFFSET_GREEN]),
-                uchar(imgData[index0 + OFFSET_BLUE ])
-            }.toHsl();
+    return frame.frame;
+}
 
-            const auto clr = QColor::fromHslF(     particleClr.hslHueF(),
-                                              lerp(particleClr.hslSaturationF(), bgClr.hslSaturationF(), f),
-                                              lerp(particleClr.lightnessF(),     bgClr.lightnessF(),     f)
-                             ).toRgb();
+QVideoFrame Renderer::convert(const FrameState &state, const QImage &img)
+{
+    PooledFrame frame;
 
-            // order is reversed, probably some little/big endian stuff idk
-            imgData[index0 + OFFSET_RED  ] = clr.red();
-            imgData[index0 + OFFSET_GREEN] = clr.green();
-            imgData[index0 + OFFSET_BLUE ] = clr.blue();
-        }
+    {
+        const trace::ScopedTimer timer(trace::Stage::Wrap);
+        frame = m_yuvPool->acquire();
+
+        const quint64 frameTime = state.frame * frameDelay;
+        frame.frame.setStartTime(frameTime);
+        frame.frame.setEndTime(frameTime + frameDelay);
     }
 
-    updateParticles();
+    // otherwise the encoder (or the Y4mWriter) converts on its own thread, which is the pipeline's slowest one already
+    const auto convertRows = m_pixelFormat == PixelFormat::Nv12 ? argbToNv12 : argbToI420;
 
-    // properly init the frame
-    m_vframe = QVideoFrame(img);
-    m_vframe.setStartTime(frameTime);
-    m_vframe.setEndTime(frameTime + frameDelay);
+    parallelFor(m_pool, chromaSize(m_size.height()), m_threads, [&] (int begin, int end, int) {
+        const trace::ScopedTimer timer(trace::Stage::Convert);
+        convertRows(img.constBits(), img.bytesPerLine(), m_size.width(), m_size.height(), frame.planes, begin, end);
+    });
 
-    // update tracking variables
-    frameTime += frameDelay;
-    ++currentFrame;
+    return frame.frame;
+}
 
-    m_z += scale;
+void Renderer::reportStats()
+{
+    if (m_frameWriter)
+        m_frameWriter->finish();
+
+    qCInfo(lcRenderer) << "Rendering done!" << m_renderTimer.elapsed() << "ms total";
+
+    const auto wall = qreal(m_renderTimer.nsecsElapsed());
+    const auto percent = [wall] (qint64 ns) { return qRound(100 * ns / wall); };
+    const auto frames = qreal(std::max<quint64>(framesToRender, 1));
+
+    qCInfo(lcRenderer).nospace() << "simulate: " << percent(m_stats.simulating) << "% busy, "
+                                 << percent(m_stats.simulationStalled) << "% blocked by the rasterizer";
+    qCInfo(lcRenderer).nospace() << "rasterize: " << percent(m_stats.rasterizing) << "% busy, "
+                                 << percent(m_stats.rasterizerStarved) << "% waiting for the simulation, "
+                                 << percent(m_stats.rasterizerStalled) << "% blocked by the encoder";
+    qCInfo(lcRenderer).nospace() << "queues: " << m_stats.simulatedQueued / frames << "/" << m_simulated.capacity() << " simulated and "
+                                 << m_stats.renderedQueued / frames << "/" << m_rendered.capacity() << " rendered frames waiting on average";
+
+    const auto poolStats = m_framePool->stats();
+    qCInfo(lcRenderer).nospace() << "frame pool: " << poolStats.allocated << "/" << m_framePool->capacity() << " buffers, "
+                                 << poolStats.misses << " of " << poolStats.acquired << " frames found it empty";
+
+    if (m_yuvPool) {
+        const auto yuvStats = m_yuvPool->stats();
+        qCInfo(lcRenderer).nospace() << "yuv frame pool: " << yuvStats.allocated << "/" << m_yuvPool->capacity() << " buffers, "
+                                     << yuvStats.misses << " of " << yuvStats.acquired << " frames found it empty";
+    }
+
+    if (m_frameWriter) {
+        const auto writerStats = m_frameWriter->stats();
+        qCInfo(lcRenderer).nospace() << "frame writer: " << writerStats.written << " " << FrameWriter::suffix(m_frameWriter->format()) << " frames saved, "
+                                     << writerStats.failed << " failed, " << writerStats.dropped << " dropped, "
+                                     << writerStats.blocked << " blocked the rasterizer for " << writerStats.blockedNs / 1000000 << " ms";
+    }
+
+    if (m_verifier)
+        m_verifier->finish();
 
-    if (m_saveFrames)
-        img.save(QString("data/frame_%1.png").arg(currentFrame, 3, 10, QChar('0')));
+        qCInfo(lcRenderer).nospace() << "flow field sampled max angular error (1/" << flowErrorStride << " of the particles): " << m_maxSampledFlowError << " rad";
+        qCInfo(lcRenderer).nospace() << "flow field max angular error, sampled over every " << flowErrorStride << "th particle: " << m_maxSampledFlowError << " rad";
 
-    qCInfo(lcRenderer) << "rendering done in" << timing.elapsed() << "ms (" << (qreal(1000) / timing.elapsed()) << "FPS)";
+    if (m_compareTrails && framesToRender > 0) {
+        qCInfo(lcRenderer).nospace() << renderModeName(m_renderMode) << " vs. trails over " << framesToRender << " frames: mean difference "
+                                     << m_comparison.meanSum / frames << ", max difference " << m_comparison.max
+                                     << ", mean PSNR " << m_comparison.psnrSum / frames << " dB";
+    }
+}
 
-    emit frameRendered(m_vframe);
+void Renderer::rasterizeTrails(const FrameState &state, QRgb *pixels)
+{
+    // every thread owns a horizontal band of the image and walks all trails in the same order as a single thread would,
+    // so each pixel still sees the exact same sequence of blends and the output doesn't depend on the thread count
+    parallelFor(m_pool, m_size.height(), m_threads, [this, &state, pixels] (int yBegin, int yEnd, int chunk) {
+        const trace::ScopedTimer timer(trace::Stage::Blend);
+
+        dispatchTrailLength(m_trailLength, [&] (auto length) {
+            if (m_tileShift && m_blendMode == BlendMode::Fast)
+                blendTrailsTiled<BlendMode::Fast, length()>(state, pixels, yBegin, yEnd, m_tiles[chunk]);
+            else if (m_tileShift)
+                blendTrailsTiled<BlendMode::Exact, length()>(state, pixels, yBegin, yEnd, m_tiles[chunk]);
+            else if (m_blendMode == BlendMode::Fast)
+                blendTrails<BlendMode::Fast, length()>(state, pixels, yBegin, yEnd);
+            else
+                blendTrails<BlendMode::Exact, length()>(state, pixels, yBegin, yEnd);
+        });
+    });
 }
 
-QPair<QPointF, int> Renderer::makeParticle()
+void Renderer::rasterizeIncremental(const FrameState &state, QRgb *pixels)
 {
-    auto pos = QPointF{m_rng->generateDouble() * width(), m_rng->generateDouble() * height()};
-    auto lifetime = m_rng->bounded(2 * Particle::queueSize, Particle::maxLifetime);
-    return {pos, lifetime};
+    // same banding as rasterizeTrails(); fading, splatting and the conversion of a band don't touch any other band
+    parallelFor(m_pool, m_size.height(), m_threads, [this, &state, pixels] (int yBegin, int yEnd, int) {
+        const auto begin = std::size_t(yBegin) * m_size.width();
+        const auto end = std::size_t(yEnd) * m_size.width();
+
+        const int background[3] = { bg.red() << 8, bg.green() << 8, bg.blue() << 8 };
+
+        {
+            const trace::ScopedTimer timer(trace::Stage::Clear);
+
+            for (int c = 0; c < 3; ++c) {
+                auto channel = m_accumulation[c].data();
+
+                for (auto i = begin; i < end; ++i)
+                    channel[i] = background[c] + (int(channel[i]) - background[c]) * m_fadeKeep / 32768;
+            }
+        }
+
+        const trace::ScopedTimer timer(trace::Stage::Blend);
+
+        dispatchTrailLength(m_trailLength, [&] (auto length) {
+            if (m_blendMode == BlendMode::Fast)
+                splatHeads<BlendMode::Fast, length()>(state, yBegin, yEnd);
+            else
+                splatHeads<BlendMode::Exact, length()>(state, yBegin, yEnd);
+        });
+
+        if (!pixels)
+            return;
+
+        const auto r = m_accumulation[0].data();
+        const auto g = m_accumulation[1].data();
+        const auto b = m_accumulation[2].data();
+
+        for (auto i = begin; i < end; ++i)
+            pixels[i] = qRgb((r[i] + 128) >> 8, (g[i] + 128) >> 8, (b[i] + 128) >> 8);
+    });
 }
 
-void Renderer::updateParticles()
+void Renderer::rasterizeDensity(const FrameState &state, QRgb *pixels)
 {
-    for (auto &p: m_particles) {
-        // just keep reusing the same particles
-        if (p.lifeTime() == 0) {
-            auto newP = makeParticle();
-            p.reset(newP.first, newP.second);
-            continue;
+    // the same banding once more, every band multiplies and maps its own pixels only
+    parallelFor(m_pool, m_size.height(), m_threads, [this, &state, pixels] (int yBegin, int yEnd, int) {
+        const auto begin = std::size_t(yBegin) * m_size.width();
+        const auto end = std::size_t(yEnd) * m_size.width();
+        const auto transmittance = m_transmittance.data();
+
+        {
+            const trace::ScopedTimer timer(trace::Stage::Clear);
+            std::fill(transmittance + begin, transmittance + end, 1.f);
         }
 
-        auto noise = m_noise.noise(p.pos().x() * scale, p.pos().y() * scale, m_z);
-        p.tick(noise * Particle::pStep, width(), height());
+        const trace::ScopedTimer timer(trace::Stage::Blend);
+
+        dispatchTrailLength(m_trailLength, [&] (auto length) {
+            accumulateTrails<length()>(state, yBegin, yEnd);
+        });
+
+        const auto toneMap = m_toneMap.data();
+
+        for (auto i = begin; i < end; ++i)
+            pixels[i] = toneMap[int(transmittance[i] * toneMapLevels + 0.5f)];
+    });
+}
+
+template <BlendMode Mode, int Length>
+void Renderer::splatHeads(const FrameState &state, int yBegin, int yEnd)
+{
+    const auto x = m_particles.trailX(0, state.head);
+    const auto y = m_particles.trailY(0, state.head);
+    const auto lifeTimes = state.lifeTimes.data();
+    const auto initialLifeTimes = state.initialLifeTimes.data();
+
+    for (int p = 0; p < m_particles.count(); ++p) {
+        const auto imgPos = clampPositionToImage(x[p], y[p], m_size.width(), m_size.height());
+
+        if (imgPos.y() < yBegin || imgPos.y() >= yEnd)
+            continue;
+
+        const auto i = std::size_t(imgPos.x()) + std::size_t(imgPos.y()) * m_size.width();
+        auto &r = m_accumulation[0][i];
+        auto &g = m_accumulation[1][i];
+        auto &b = m_accumulation[2][i];
+
+        auto pixel = qRgb((r + 128) >> 8, (g + 128) >> 8, (b + 128) >> 8);
+        m_blender.blend<Mode>(pixel, getAgeOfPosition<Length>(0, lifeTimes[p], initialLifeTimes[p]));
+
+        r = qRed(pixel) << 8;
+        g = qGreen(pixel) << 8;
+        b = qBlue(pixel) << 8;
     }
 }
 
-template<typename T, int Size>
-Queue<T, Size>::Queue(T fill)
-    : m_step(0)
+void Renderer::compareWithTrails(const FrameState &state, const QImage &img)
 {
-    for (int i = 0; i < Size; ++i)
-        m_data[i] = fill;
+    QImage reference(m_size.width(), m_size.height(), QImage::Format::Format_ARGB32);
+    reference.fill(bg);
+    rasterizeTrails(state, reinterpret_cast<QRgb *>(reference.bits()));
+
+    const auto diff = compareImages(img, reference);
+
+    m_comparison.meanSum += diff.mean;
+    m_comparison.psnrSum += diff.psnr;
+    m_comparison.max = std::max(m_comparison.max, diff.max);
+
+    qCInfo(lcRendererFrames).nospace() << renderModeName(m_renderMode) << " vs. trails: mean difference " << diff.mean << ", max difference " << diff.max << ", PSNR " << diff.psnr << " dB";
 }
 
-template<typename T, int Size>
-T &Queue<T, Size>::get(int idx)
+template <BlendMode Mode, int Length>
+void Renderer::blendTrails(const FrameState &state, QRgb *pixels, int yBegin, int yEnd)
 {
-    return m_data[(idx + m_step) % Size]; // bitwise and didn't seem to give any performance improvements
+    // resolve the shared ring buffer once per frame instead of once per sample
+    const Particle::Coord *trailX[Length];
+    const Particle::Coord *trailY[Length];
+
+    for (int i = 0; i < Length; ++i) {
+        trailX[i] = m_particles.trailX(i, state.head);
+        trailY[i] = m_particles.trailY(i, state.head);
+    }
+
+    const auto lifeTimes = state.lifeTimes.data();
+    const auto initialLifeTimes = state.initialLifeTimes.data();
+
+    for (int p = 0; p < m_particles.count(); ++p) {
+        for (int i = Length - 1; i >= 0; --i) {
+            const auto imgPos = clampPositionToImage(trailX[i][p], trailY[i][p], m_size.width(), m_size.height());
+
+            if (imgPos.y() < yBegin || imgPos.y() >= yEnd)
+                continue;
+
+            const int age = getAgeOfPosition<Length>(i, lifeTimes[p], initialLifeTimes[p]);
+
+            m_blender.blend<Mode>(pixels[imgPos.x() + imgPos.y() * m_size.width()], age);
+        }
+    }
 }
 
-Particle::Particle(QPointF pos, int lifetime)
-    : m_positions(pos)
-    , m_lifeTime(lifetime)
-    , m_initialLifeTime(lifetime)
-{}
+template <BlendMode Mode, int Length>
+void Renderer::blendTrailsTiled(const FrameState &state, QRgb *pixels, int yBegin, int yEnd, std::vector<std::vector<TileSample>> &tiles)
+{
+    const int tileSize = 1 << m_tileShift;
+    const int tilesX = (m_size.width() + tileSize - 1) >> m_tileShift;
+    const int tilesY = (yEnd - yBegin + tileSize - 1) >> m_tileShift;
+
+    tiles.resize(std::size_t(tilesX) * tilesY);
+
+    const Particle::Coord *trailX[Length];
+    const Particle::Coord *trailY[Length];
+
+    for (int i = 0; i < Length; ++i) {
+        trailX[i] = m_particles.trailX(i, state.head);
+        trailY[i] = m_particles.trailY(i, state.head);
+    }
+
+    const auto lifeTimes = state.lifeTimes.data();
+    const auto initialLifeTimes = state.initialLifeTimes.data();
+
+    const auto blendTiles = [&] {
+        for (auto &tile: tiles) {
+            for (const auto &sample: tile)
+                m_blender.blend<Mode>(pixels[sample.pixel], sample.age);
+
+            tile.clear();
+        }
+    };
+
+    int binned = 0;
+
+    for (int p = 0; p < m_particles.count(); ++p) {
+        for (int i = Length - 1; i >= 0; --i) {
+            const auto imgPos = clampPositionToImage(trailX[i][p], trailY[i][p], m_size.width(), m_size.height());
 
-void Particle::tick(qreal direction, int w, int h)
+            if (imgPos.y() < yBegin || imgPos.y() >= yEnd)
+                continue;
+
+            const int tile = ((imgPos.y() - yBegin) >> m_tileShift) * tilesX + (imgPos.x() >> m_tileShift);
+            const int age = getAgeOfPosition<Length>(i, lifeTimes[p], initialLifeTimes[p]);
+
+            tiles[tile].push_back({quint32(imgPos.x() + imgPos.y() * m_size.width()), quint32(age)});
+        }
+
+        // batches are blended in particle order as well, so every pixel still sees its samples in the original order
+        if ((binned += Length) >= tileBatchSamples) {
+            blendTiles();
+            binned = 0;
+        }
+    }
+
+    blendTiles();
+}
+
+template <int Length>
+void Renderer::accumulateTrails(const FrameState &state, int yBegin, int yEnd)
 {
-    const auto p = pos();
-    auto aX = p.x() + cos(direction);
-    auto aY = p.y() + sin(direction);
+    const Particle::Coord *trailX[Length];
+    const Particle::Coord *trailY[Length];
+
+    for (int i = 0; i < Length; ++i) {
+        trailX[i] = m_particles.trailX(i, state.head);
+        trailY[i] = m_particles.trailY(i, state.head);
+    }
+
+    const auto lifeTimes = state.lifeTimes.data();
+    const auto initialLifeTimes = state.initialLifeTimes.data();
+    const auto transmittance = m_transmittance.data();
 
-    if (aX > w)
-        aX = 0;
-    if (aX < 0)
-        aX = w;
+    for (int p = 0; p < m_particles.count(); ++p) {
+        for (int i = Length - 1; i >= 0; --i) {
+            const auto imgPos = clampPositionToImage(trailX[i][p], trailY[i][p], m_size.width(), m_size.height());
 
-    if (aY > h)
-        aY = 0;
-    if (aY < 0)
-        aY = h;
+            if (imgPos.y() < yBegin || imgPos.y() >= yEnd)
+                continue;
 
-    changePos({aX, aY});
+            const int age = getAgeOfPosition<Length>(i, lifeTimes[p], initialLifeTimes[p]);
+            auto &t = transmittance[imgPos.x() + std::size_t(imgPos.y()) * m_size.width()];
 
-    --m_lifeTime;
+            t = std::max(t * m_ageTransmittance[age], minTransmittance);
+        }
+    }
 }
 
-void Particle::reset(QPointF newPos, int newLifeTime)
+QPair<QPointF, int> Renderer::makeParticle(int idx)
 {
-    changePos(newPos);
-    m_initialLifeTime = newLifeTime;
-    m_lifeTime = newLifeTime;
+    const auto generation = m_generations[idx];
+
+    auto pos = QPointF{m_rng.uniform(idx, generation, 0) * width(), m_rng.uniform(idx, generation, 1) * height()};
+    // long trails need longer lives, the default ones keep the original range
+    const int minLifetime = 2 * m_trailLength;
+    auto lifetime = m_rng.bounded(idx, generation, 2, minLifetime, std::max(Particle::maxLifetime, minLifetime + minLifetime / 2));
+    return {pos, lifetime};
 }
 
-void Particle::changePos(QPointF newPos)
+void Renderer::updateParticles()
 {
-    m_positions.next();
-    m_positions.get(0) = newPos;
+    const trace::ScopedTimer timer(trace::Stage::Update);
+
+    m_particles.advance();
+
+    const auto lifeTimes = m_particles.lifeTimes();
+    // tick() hasn't moved them yet
+    const auto prevX = m_particles.x();
+    const auto prevY = m_particles.y();
+
+    if (m_flowField)
+        m_flowField->prepare(m_simulationFrame);
+
+    parallelFor(m_pool, m_particles.count(), m_threads, [&] (int begin, int end, int chunk) {
+        auto &expired = m_expired[chunk];
+        expired.clear();
+
+        // expired particles get a direction as well, it's just never used
+        if (m_flowField) {
+            m_flowField->sample(prevX + begin, prevY + begin, m_directions.data() + begin, end - begin);
+
+            // keep track of how far off we are using a sparse subset
+            for (int p = begin; p < end; p += flowErrorStride) {
+                const auto exact = m_noise.noise(prevX[p] * scale, prevY[p] * scale, m_z);
+                m_sampledFlowError[chunk] = std::max(m_sampledFlowError[chunk], angularError(exact, m_directions[p]));
+            }
+        } else if (m_scalarNoise) {
+            for (int p = begin; p < end; ++p)
+                m_directions[p] = m_noise.noise(prevX[p] * scale, prevY[p] * scale, m_z);
+        } else {
+            m_noise.noise(prevX + begin, prevY + begin, Particle::Scalar(m_z), m_directions.data() + begin, end - begin, Particle::Scalar(scale));
+        }
+
+        for (int p = begin; p < end; ++p) {
+            m_directions[p] *= Particle::pStep;
+
+            if (lifeTimes[p] == 0)
+                expired.append(p);
+        }
+
+        m_particles.tick(begin, end, m_directions.data(), width(), height(), m_fastTrig);
+
+        // just keep reusing the same particles. the new one's numbers only depend on its index and generation,
+        // so respawning right here gives the same result for any thread count
+        for (const int p: std::as_const(expired)) {
+            ++m_generations[p];
+
+            const auto newP = makeParticle(p);
+            m_particles.reset(p, newP.first.x(), newP.first.y(), newP.second);
+        }
+    });
+
+    for (const auto error: std::as_const(m_sampledFlowError))
+        m_maxSampledFlowError = std::max(m_maxSampledFlowError, error);
 }
 
 } // namespace randomly
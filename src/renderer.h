@@ -2,109 +2,266 @@
 #define RENDERER_H
 
 #include "../PerlinNoise/perlinnoise.h"
+#include "blend.h"
+#include "counterrng.h"
+#include "flowfield.h"
+#include "framepool.h"
+#include "framewriter.h"
+#include "particlestore.h"
+#include "spscqueue.h"
+#include "trajectory.h"
+#include "verifier.h"
 
 #include <QElapsedTimer>
 #include <QObject>
-#include <QRandomGenerator>
 #include <QVideoFrame>
 
-namespace randomly {
-
-class Recorder;
-
-template <typename T, int Size>
-class Queue
-{
-public:
-    Queue(T fill);
-
-    constexpr auto length() const { return Size; }
+#include <array>
+#include <atomic>
+#include <memory>
 
-    void next() { m_step = m_step ? (m_step - 1) : Size - 1; }
-    T &get(int idx);
+class QThread;
+class QThreadPool;
 
-private:
-    T m_data[Size];
-    int m_step;
-};
+namespace randomly {
 
-class Particle
+enum class RenderMode
 {
-public:
-    static constexpr int maxLifetime = 8 * 60; // 8 seconds
-    static constexpr qreal pStep = 4 * M_PI;
-
-    static constexpr int  queueSize = 128;
-    static constexpr auto queueSizeInv = 1./queueSize;
-
-    Particle(QPointF pos, int lifetime);
-    Particle(QPair<QPointF, int> data) : Particle(data.first, data.second) {}
-    
-    void tick(qreal direction, int w, int h);
-    void reset(QPointF newPos, int newLifeTime);
-    int lifeTime() const { return m_lifeTime; }
-    QPointF pos() { return m_positions.get(0); }
-    auto positions() { return m_positions; }
-    int initialLifeTime() { return m_initialLifeTime; }
-
-private:
-    void changePos(QPointF newPos);
-
-    Queue<QPointF, queueSize> m_positions;
-    int m_lifeTime;
-    int m_initialLifeTime;
+    Trails,      // redraws every trail position of every particle each frame
+    Incremental, // fades a persistent buffer and only draws the newest positions
+    Density,     // multiplies up what every sample leaves of the background per pixel, then maps that to a colour in one pass
 };
 
+// as given to --render-mode
+const char *renderModeName(RenderMode mode);
+
 struct RenderInfo
 {
     QSize size = {1920, 1080};
+    quint64 startFrame = 0; // earlier frames are only simulated, for splitting a render into shards
     quint64 framesToRender = 60;
     bool saveFrames = false;
+    FrameFormat saveFormat = FrameFormat::Png;
+    WriterOverflow saveOverflow = WriterOverflow::Block;
+    int saveQueue = 8; // frames that may wait for the disk
+    int renderQueue = 2; // rendered frames that may wait for takeFrame()
     uint seed = 0;
     int particleCount = 5000;
+    int trailLength = Particle::queueSize; // a power of two in [Particle::minTrailLength, Particle::maxTrailLength]
+    int threads = 1;
+    bool fastTrig = false;
+    bool scalarNoise = false; // one PerlinNoise::noise() call per particle instead of the batch kernel, for the verifier's reference
+    int flowGrid = 0; // grid spacing of the flow field in pixels, 0 evaluates the noise for every particle
+    int flowKeyframes = 8;
+    BlendMode blendMode = BlendMode::Exact;
+    int tileSize = 0; // trails mode: bin the samples into square tiles of this size (a power of two) before blending them, 0 blends in particle order
+    RenderMode renderMode = RenderMode::Trails;
+    bool compareTrails = false; // incremental and density mode only: compare every frame against the trails mode
+    VerifyMode verifyMode = VerifyMode::Off;
+    QString manifest; // written by VerifyMode::Verify, read by VerifyMode::Check
+    QString recordTrajectory; // file to record the simulation to
+    QString replayTrajectory; // file to take the simulation from instead of running it, see TrajectoryReader
+    PixelFormat pixelFormat = PixelFormat::Argb32; // of the frames given out by takeFrame()
+};
+
+// everything the rasterizer needs to know about a simulated frame, the trail positions themselves stay in the ParticleStore
+struct FrameState
+{
+    quint64 frame = 0;
+    qint64 simulatedAt = 0; // m_renderTimer nanoseconds
+    int head = 0;
+    std::vector<int> lifeTimes;
+    std::vector<int> initialLifeTimes;
 };
 
+// renders in a pipeline of three stages working at the same time: simulating frame N+2, rasterizing frame N+1
+// and encoding frame N (whoever calls takeFrame()). the stages are connected by bounded lock-free queues,
+// so a slow encoder eventually blocks the rasterizer, which in turn blocks the simulation
 class Renderer : public QObject
 {
     Q_OBJECT
 public:
-    explicit Renderer(QObject *parent = nullptr, Recorder *recorder = nullptr, const RenderInfo &info = {});
+    explicit Renderer(QObject *parent = nullptr, const RenderInfo &info = {});
+    ~Renderer();
+
+    // starts the simulation and rasterizer threads
+    void start();
+    // drops the frames nobody took yet, the threads return without wrapping up
+    void stop();
+    // blocks until the simulation and rasterizer threads are done. after handing out the last frame, the rasterizer
+    // still finishes the frame writer and the verifier and reports its statistics
+    void wait();
 
-    void render();
+    // gets the next rendered frame, if there already is one
+    bool takeFrame(QVideoFrame &frame);
+    // the same, age is how many nanoseconds ago the frame's simulation step finished
+    bool takeFrame(QVideoFrame &frame, qint64 &age);
 
     int width()  { return m_size.width();  }
     int height() { return m_size.height(); }
 
-    int framesRendered() { return currentFrame; }
+    int framesRendered() { return m_framesRendered; }
     int targetFrames() { return framesToRender; }
 
+    // only false if a frame didn't match the manifest given with VerifyMode::Check
+    bool verificationPassed() const { return !m_verifier || m_verifier->passed(); }
+
 signals:
-    void frameRendered(QVideoFrame &frame);
+    // emitted from the rasterizer thread whenever there is a new frame to take
+    void frameRendered();
 
 private:
+    // both drive the stages synchronously, one at a time
+    friend class RendererBench;
+    friend class FrameVerifier;
+
     QSize m_size;
-    QVideoFrame m_vframe;
-    Recorder *m_recorder;
     PerlinNoise m_noise;
     QElapsedTimer m_renderTimer;
 
-    quint64 currentFrame = 0;
+    std::atomic<quint64> m_framesRendered = 0;
+    const quint64 m_startFrame;
     const quint64 framesToRender;
 
-    quint64 frameTime = 0;
     static constexpr quint64 frameDelay = 16667LL; // microseconds; around 60 FPS
 
-    bool m_saveFrames;
-    QRandomGenerator *m_rng;
+    std::unique_ptr<FrameWriter> m_frameWriter; // only with saveFrames
+    CounterRng m_rng;
+    std::vector<quint32> m_generations; // respawns per particle, part of the rng counter
 
+    // simulation state, only touched by the simulation thread after start()
+    quint64 m_simulationFrame = 0;
     qreal m_z = 0;
 
     static constexpr qreal scale = 0.002;
 
-    QPair<QPointF, int> makeParticle();
+    // position and lifetime of the particle idx's current generation
+    QPair<QPointF, int> makeParticle(int idx);
 
     void updateParticles();
-    QList<Particle> m_particles;
+    const int m_trailLength;
+    ParticleStore m_particles;
+
+    std::unique_ptr<TrajectoryWriter> m_trajectoryWriter;
+    std::unique_ptr<TrajectoryReader> m_trajectoryReader; // replaces updateParticles()
+
+    void simulationLoop();
+    // brings the simulation (and the incremental mode's buffer) to m_startFrame without rasterizing anything
+    void fastForward();
+    // updateParticles() (or the replayed frame) and moving on to the next frame's noise
+    void step();
+    void snapshot(quint64 frame, FrameState &state) const;
+    void rasterizerLoop();
+    void reportStats();
+
+    QVideoFrame rasterize(const FrameState &state);
+    void rasterizeTrails(const FrameState &state, QRgb *pixels);
+    // without pixels, only the persistent buffer gets updated
+    void rasterizeIncremental(const FrameState &state, QRgb *pixels);
+    void rasterizeDensity(const FrameState &state, QRgb *pixels);
+    void compareWithTrails(const FrameState &state, const QImage &img);
+    // the rasterized image in m_pixelFormat, converted on m_pool
+    QVideoFrame convert(const FrameState &state, const QImage &img);
+
+    // only blend samples that land in the rows [yBegin, yEnd), Length is m_trailLength
+    template <BlendMode Mode, int Length>
+    void blendTrails(const FrameState &state, QRgb *pixels, int yBegin, int yEnd);
+    template <BlendMode Mode, int Length>
+    void splatHeads(const FrameState &state, int yBegin, int yEnd);
+    template <int Length>
+    void accumulateTrails(const FrameState &state, int yBegin, int yEnd);
+
+    struct TileSample
+    {
+        quint32 pixel;
+        quint32 age;
+    };
+
+    // the same as blendTrails(), but the samples are first sorted into the tiles of the band and then blended
+    // one tile at a time, so the blends stay within a cache sized part of the image. every tile keeps the samples
+    // in the order blendTrails() would blend them, the output is identical
+    template <BlendMode Mode, int Length>
+    void blendTrailsTiled(const FrameState &state, QRgb *pixels, int yBegin, int yEnd, std::vector<std::vector<TileSample>> &tiles);
+
+    int m_threads;
+    QThreadPool *m_pool;
+
+    bool m_fastTrig;
+    bool m_scalarNoise;
+    std::vector<Particle::Scalar> m_directions;
+    QList<QList<int>> m_expired; // per chunk of updateParticles()
+
+    std::unique_ptr<FlowField> m_flowField;
+    QList<qreal> m_sampledFlowError; // per chunk of updateParticles(), in radians, sampled from every flowErrorStride-th particle
+    qreal m_maxSampledFlowError = 0;
+
+    BlendMode m_blendMode;
+    TrailBlender m_blender;
+
+    int m_tileShift; // log2 of the tile size, 0 without tiles
+    std::vector<std::vector<std::vector<TileSample>>> m_tiles; // per chunk of rasterizeTrails(), kept for their capacity
+
+    RenderMode m_renderMode;
+    // per frame factor of the incremental mode's fade towards the background (15 bit fixed point, so the products fit into an int),
+    // chosen so that a full trail length later only 1/256 of the original difference is left
+    const int m_fadeKeep;
+    std::array<std::vector<quint16>, 3> m_accumulation; // incremental mode; r, g, b planes in 8.8 fixed point
+
+    // density mode. a blend moves saturation and lightness towards the particle colour by a factor only depending on the age,
+    // so any number of them comes down to the product of those factors: how much of the background is left
+    std::vector<float> m_transmittance;
+    std::array<float, Particle::maxTrailLength + 1> m_ageTransmittance; // age / trail length
+    std::vector<QRgb> m_toneMap; // colour for a quantized transmittance
+
+    std::unique_ptr<FrameVerifier> m_verifier;
+
+    bool m_compareTrails;
+    struct {
+        qreal meanSum = 0;
+        qreal psnrSum = 0;
+        int max = 0;
+    } m_comparison;
+
+    // how many frames may wait for the rasterizer, and how many QVideoFrameInput keeps queued itself.
+    // RenderInfo::renderQueue is how many may wait for the encoder
+    static constexpr int simulationQueueDepth = 2;
+    static constexpr int encoderQueueDepth = 2;
+
+    // the queued states plus the one being filled and the one being rasterized.
+    // m_particles keeps as many history slots, so a queued state's trail isn't overwritten by the simulation
+    static constexpr int frameStateCount = simulationQueueDepth + 2;
+
+    // frames alive at the same time: the queued ones, the one being rasterized, the one the recorder
+    // is trying to send, the ones queued by the encoder and the ones waiting for the frame writer.
+    // with a YUV pixel format the encoder's share moves to m_yuvPool, the images are only rasterized into and saved
+    const PixelFormat m_pixelFormat;
+    std::shared_ptr<FramePool> m_framePool;
+    std::shared_ptr<FramePool> m_yuvPool;
+
+    std::vector<FrameState> m_states;
+    SpscQueue<FrameState *> m_freeStates; // rasterizer -> simulation
+    SpscQueue<FrameState *> m_simulated;  // simulation -> rasterizer
+    struct RenderedFrame
+    {
+        QVideoFrame frame;
+        qint64 simulatedAt = 0;
+    };
+
+    SpscQueue<RenderedFrame> m_rendered;  // rasterizer -> encoder
+
+    std::unique_ptr<QThread> m_simulationThread;
+    std::unique_ptr<QThread> m_rasterizerThread;
+
+    // nanoseconds per stage and summed up queue sizes, for finding the bottleneck
+    struct {
+        std::atomic<qint64> simulating = 0;
+        std::atomic<qint64> simulationStalled = 0; // waiting for a free frame state or room in the queue
+        std::atomic<qint64> rasterizing = 0;
+        std::atomic<qint64> rasterizerStarved = 0; // waiting for the simulation
+        std::atomic<qint64> rasterizerStalled = 0; // waiting for the encoder
+        std::atomic<quint64> simulatedQueued = 0;
+        std::atomic<quint64> renderedQueued = 0;
+    } m_stats;
 };
 
 } // namespace randomly
@@ -0,0 +1,113 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <QtGlobal>
+
+#include <atomic>
+#include <vector>
+
+namespace randomly {
+
+// bounded single producer / single consumer queue.
+// pushing and popping are lock-free, only waiting for room or elements blocks (on a futex through std::atomic::wait)
+template <typename T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue(int capacity) : m_slots(std::max(capacity, 1)) {}
+
+    int capacity() const { return int(m_slots.size()); }
+    int size() const { return int(m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire)); }
+
+    // moves out of value on success
+    bool tryPush(T &value);
+    bool tryPop(T &value);
+
+    // block until there is room or an element; return false once the queue was closed
+    bool push(T value) { return waitFor([&] { return tryPush(value); }); }
+    bool pop(T &value) { return waitFor([&] { return tryPop(value); }); }
+
+    // fails every blocked and future push() and pop(), used to shut down the threads on both ends
+    void close();
+
+private:
+    template <typename Condition>
+    bool waitFor(Condition condition);
+    void notify();
+
+    std::vector<T> m_slots;
+
+    alignas(64) std::atomic<quint64> m_head = 0; // next element to pop, only written by the consumer
+    alignas(64) std::atomic<quint64> m_tail = 0; // next free slot, only written by the producer
+    alignas(64) std::atomic<quint32> m_signal = 0; // bumped on every change, blocked threads wait on it
+    std::atomic<bool> m_closed = false;
+};
+
+template <typename T>
+bool SpscQueue<T>::tryPush(T &value)
+{
+    const auto tail = m_tail.load(std::memory_order_relaxed);
+
+    if (tail - m_head.load(std::memory_order_acquire) == m_slots.size())
+        return false;
+
+    m_slots[tail % m_slots.size()] = std::move(value);
+    m_tail.store(tail + 1, std::memory_order_release);
+
+    notify();
+    return true;
+}
+
+template <typename T>
+bool SpscQueue<T>::tryPop(T &value)
+{
+    const auto head = m_head.load(std::memory_order_relaxed);
+
+    if (head == m_tail.load(std::memory_order_acquire))
+        return false;
+
+    auto &slot = m_slots[head % m_slots.size()];
+    value = std::move(slot);
+    slot = T{}; // don't keep anything alive that was moved out of (e.g. pooled frames)
+
+    m_head.store(head + 1, std::memory_order_release);
+
+    notify();
+    return true;
+}
+
+template <typename T>
+void SpscQueue<T>::close()
+{
+    m_closed = true;
+    notify();
+}
+
+template <typename T>
+template <typename Condition>
+bool SpscQueue<T>::waitFor(Condition condition)
+{
+    while (true) {
+        // read the signal before checking, so a change in between makes wait() return immediately
+        const auto signal = m_signal.load();
+
+        if (m_closed)
+            return false;
+
+        if (condition())
+            return true;
+
+        m_signal.wait(signal);
+    }
+}
+
+template <typename T>
+void SpscQueue<T>::notify()
+{
+    m_signal.fetch_add(1);
+    m_signal.notify_all();
+}
+
+} // namespace randomly
+
+#endif // SPSCQUEUE_H
@@ -0,0 +1,220 @@
+#include "trace.h"
+
+#include <QFile>
+#include <QLoggingCategory>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+namespace randomly {
+namespace trace {
+
+namespace
+{
+
+Q_LOGGING_CATEGORY(lcTrace, "randomly.Trace");
+
+constexpr std::size_t ringSize = 1 << 16;
+
+struct Event
+{
+    qint64 begin;
+    qint64 end;
+    Stage stage;
+};
+
+// only ever written by its own thread, the readers run after the work is done
+struct ThreadBuffer
+{
+    int id = 0;
+    QString name;
+    std::unique_ptr<Event[]> events{new Event[ringSize]};
+    std::atomic<quint64> written = 0;
+
+    template <typename F>
+    void forEach(F &&fn) const
+    {
+        const auto end = written.load(std::memory_order_acquire);
+        const auto begin = end > ringSize ? end - ringSize : 0;
+
+        for (auto i = begin; i < end; ++i)
+            fn(events[i % ringSize]);
+    }
+};
+
+std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+
+QMutex registryMutex;
+std::vector<std::unique_ptr<ThreadBuffer>> registry; // never shrinks, so buffers of finished threads stay readable
+
+thread_local ThreadBuffer *threadBuffer = nullptr;
+
+// the contents of a JSON string literal, thread names can be anything
+QString escapeJson(const QString &str)
+{
+    QString escaped;
+    escaped.reserve(str.size());
+
+    for (const QChar c: str) {
+        if (c == u'"' || c == u'\\')
+            escaped += u'\\';
+
+        if (c.unicode() < 0x20)
+            escaped += QString("\\u%1").arg(int(c.unicode()), 4, 16, QChar(u'0'));
+        else
+            escaped += c;
+    }
+
+    return escaped;
+}
+
+ThreadBuffer *currentBuffer()
+{
+    if (!threadBuffer) {
+        auto buffer = std::make_unique<ThreadBuffer>();
+        buffer->name = QThread::currentThread()->objectName();
+
+        const QMutexLocker locker(&registryMutex);
+        buffer->id = int(registry.size()) + 1;
+        if (buffer->name.isEmpty())
+            buffer->name = QString("thread %1").arg(buffer->id);
+
+        threadBuffer = buffer.get();
+        registry.push_back(std::move(buffer));
+    }
+
+    return threadBuffer;
+}
+
+} // namespace
+
+std::atomic<bool> enabledFlag = false;
+
+const char *name(Stage stage)
+{
+    switch (stage) {
+    case Stage::Clear:   return "clear";
+    case Stage::Blend:   return "blend";
+    case Stage::Update:  return "update";
+    case Stage::Wrap:    return "wrap";
+    case Stage::Convert: return "convert";
+    case Stage::Save:    return "save";
+    case Stage::Encode:  return "encode";
+    case Stage::Count:   break;
+    }
+
+    return "?";
+}
+
+void setEnabled(bool enabled)
+{
+    if (enabled && !isEnabled())
+        origin = std::chrono::steady_clock::now();
+
+    enabledFlag.store(enabled, std::memory_order_relaxed);
+}
+
+qint64 now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+}
+
+void record(Stage stage, qint64 begin, qint64 end)
+{
+    auto buffer = currentBuffer();
+    const auto n = buffer->written.load(std::memory_order_relaxed);
+
+    buffer->events[n % ringSize] = {begin, end, stage};
+    buffer->written.store(n + 1, std::memory_order_release);
+}
+
+void printSummary()
+{
+    std::array<std::vector<qint64>, std::size_t(Stage::Count)> durations;
+    quint64 overwritten = 0;
+
+    {
+        const QMutexLocker locker(&registryMutex);
+
+        for (const auto &buffer: registry) {
+            buffer->forEach([&durations] (const Event &event) {
+                durations[std::size_t(event.stage)].push_back(event.end - event.begin);
+            });
+
+            overwritten += buffer->written > ringSize ? buffer->written - ringSize : 0;
+        }
+    }
+
+    const auto ms = [] (qint64 ns) { return ns / 1e6; };
+
+    for (std::size_t s = 0; s < durations.size(); ++s) {
+        auto &d = durations[s];
+        if (d.empty())
+            continue;
+
+        std::sort(d.begin(), d.end());
+
+        const auto percentile = [&d] (int p) { return d[std::min(d.size() - 1, d.size() * p / 100)]; };
+
+        qCInfo(lcTrace).nospace() << name(Stage(s)) << ": " << d.size() << " times, min " << ms(d.front())
+                                  << " ms, p50 " << ms(percentile(50)) << " ms, p99 " << ms(percentile(99))
+                                  << " ms, max " << ms(d.back()) << " ms";
+    }
+
+    if (overwritten > 0)
+        qCInfo(lcTrace) << overwritten << "older events were overwritten and are missing from the summary";
+}
+
+bool writeChromeTrace(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QFile::WriteOnly | QFile::Truncate)) {
+        qCWarning(lcTrace) << "could not write" << path << file.errorString();
+        return false;
+    }
+
+    QByteArray json;
+    json.append("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    bool first = true;
+    const auto separator = [&json, &first] {
+        if (!first)
+            json.append(",\n");
+        first = false;
+    };
+
+    const QMutexLocker locker(&registryMutex);
+
+    for (const auto &buffer: registry) {
+        separator();
+        json.append(QString("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%1,\"args\":{\"name\":\"%2\"}}")
+                        .arg(buffer->id).arg(escapeJson(buffer->name)).toUtf8());
+
+        // timestamps and durations are in microseconds
+        buffer->forEach([&] (const Event &event) {
+            separator();
+            json.append(QString("{\"name\":\"%1\",\"ph\":\"X\",\"pid\":1,\"tid\":%2,\"ts\":%3,\"dur\":%4}")
+                            .arg(name(event.stage)).arg(buffer->id)
+                            .arg(event.begin / 1e3, 0, 'f', 3).arg((event.end - event.begin) / 1e3, 0, 'f', 3).toUtf8());
+        });
+    }
+
+    json.append("\n]}\n");
+
+    if (file.write(json) != json.size()) {
+        qCWarning(lcTrace) << "could not write" << path << file.errorString();
+        return false;
+    }
+
+    qCInfo(lcTrace) << "trace written to" << path;
+    return true;
+}
+
+} // namespace trace
+} // namespace randomly
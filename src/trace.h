@@ -0,0 +1,75 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QString>
+
+#include <atomic>
+
+namespace randomly {
+namespace trace {
+
+enum class Stage : quint8
+{
+    Clear,   // filling the image with the background, or fading it in incremental mode
+    Blend,   // blending the trails into one band of the image
+    Update,  // moving the particles one step
+    Wrap,    // turning the image into a timed QVideoFrame
+    Convert, // converting one band of the image to YUV
+    Save,    // writing a frame to disk (--save-frames)
+    Encode,  // handing a frame to the encoder
+    Count
+};
+
+const char *name(Stage stage);
+
+extern std::atomic<bool> enabledFlag;
+
+// off by default; switch on before the renderer starts, nothing is recorded while it's off
+inline bool isEnabled()
+{
+    return enabledFlag.load(std::memory_order_relaxed);
+}
+
+void setEnabled(bool enabled);
+
+// nanoseconds since tracing got enabled
+qint64 now();
+
+// appends an event to the calling thread's ring buffer, which keeps the newest 65536 events
+void record(Stage stage, qint64 begin, qint64 end);
+
+// records the lifetime of the object as one event; with tracing off, this is a relaxed load and a branch
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(Stage stage)
+        : m_stage(stage)
+        , m_begin(isEnabled() ? now() : -1)
+    {}
+
+    ~ScopedTimer()
+    {
+        if (m_begin >= 0)
+            record(m_stage, m_begin, now());
+    }
+
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+private:
+    const Stage m_stage;
+    const qint64 m_begin;
+};
+
+// both read all threads' buffers, so the threads should be done by then
+
+// logs count, min, p50, p99 and max per stage
+void printSummary();
+
+// Chrome trace event format, for chrome://tracing or https://ui.perfetto.dev
+bool writeChromeTrace(const QString &path);
+
+} // namespace trace
+} // namespace randomly
+
+#endif // TRACE_H
@@ -0,0 +1,200 @@
+#include "trajectory.h"
+
+#include <QLoggingCategory>
+
+#include <cstring>
+
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#endif
+
+namespace randomly {
+
+namespace
+{
+
+Q_LOGGING_CATEGORY(lcTrajectory, "randomly.Trajectory");
+
+constexpr char magic[8] = {'R', 'N', 'D', 'T', 'R', 'A', 'J', '\0'};
+constexpr quint32 trajectoryVersion = 3;
+
+// frames start on a cache line, which keeps every array in them aligned as well
+constexpr qint64 frameAlignment = 64;
+
+qint64 frameBytes(quint32 particleCount)
+{
+    const auto bytes = qint64(particleCount) * (2 * sizeof(Particle::Scalar) + 2 * sizeof(quint16));
+    return (bytes + frameAlignment - 1) / frameAlignment * frameAlignment;
+}
+
+} // namespace
+
+TrajectoryWriter::TrajectoryWriter(const QString &path, QSize size, uint seed, int particleCount, int trailLength)
+    : m_file(path)
+    , m_header{}
+    , m_buffer(frameBytes(particleCount), 0)
+{
+    std::memcpy(m_header.magic, magic, sizeof(magic));
+    m_header.version = trajectoryVersion;
+    m_header.particleCount = particleCount;
+    m_header.width = size.width();
+    m_header.height = size.height();
+    m_header.seed = seed;
+    m_header.scalarSize = sizeof(Particle::Scalar);
+    m_header.trailLength = trailLength;
+
+    // the frame count is still 0, so an interrupted recording can't be mistaken for a complete one
+    if (!m_file.open(QFile::WriteOnly | QFile::Truncate) || m_file.write(reinterpret_cast<const char *>(&m_header), sizeof(m_header)) != sizeof(m_header)) {
+        qCWarning(lcTrajectory) << "could not write" << path << m_file.errorString();
+        m_failed = true;
+    }
+}
+
+TrajectoryWriter::~TrajectoryWriter()
+{
+    finish();
+}
+
+void TrajectoryWriter::write(const ParticleStore &particles)
+{
+    if (m_failed)
+        return;
+
+    const auto count = particles.count();
+    const auto x = reinterpret_cast<Particle::Scalar *>(m_buffer.data());
+    const auto y = x + count;
+    const auto lifeTimes = reinterpret_cast<quint16 *>(y + count);
+    const auto initialLifeTimes = lifeTimes + count;
+
+    std::copy_n(particles.x(), count, x);
+    std::copy_n(particles.y(), count, y);
+    std::copy_n(particles.lifeTimes(), count, lifeTimes);
+    std::copy_n(particles.initialLifeTimes(), count, initialLifeTimes);
+
+    if (m_file.write(m_buffer.data(), m_buffer.size()) != qint64(m_buffer.size())) {
+        qCWarning(lcTrajectory) << "writing frame" << m_header.frameCount << "to" << m_file.fileName() << "failed:" << m_file.errorString();
+        m_failed = true;
+        return;
+    }
+
+    ++m_header.frameCount;
+}
+
+void TrajectoryWriter::finish()
+{
+    if (m_failed || m_finished)
+        return;
+
+    m_finished = true;
+
+    if (!m_file.seek(0) || m_file.write(reinterpret_cast<const char *>(&m_header), sizeof(m_header)) != sizeof(m_header)) {
+        qCWarning(lcTrajectory) << "could not finish" << m_file.fileName() << m_file.errorString();
+        return;
+    }
+
+    m_file.close();
+
+    qCInfo(lcTrajectory).nospace() << "recorded " << m_header.frameCount << " frames of " << m_header.particleCount << " particles to "
+                                   << m_file.fileName() << " (" << (m_file.size() >> 20) << " MiB)";
+}
+
+std::optional<TrajectoryHeader> TrajectoryReader::readHeader(const QString &path)
+{
+    QFile file(path);
+    TrajectoryHeader header;
+
+    if (!file.open(QFile::ReadOnly) || file.read(reinterpret_cast<char *>(&header), sizeof(header)) != sizeof(header)) {
+        qCWarning(lcTrajectory) << "could not read" << path << file.errorString();
+        return std::nullopt;
+    }
+
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != trajectoryVersion) {
+        qCWarning(lcTrajectory) << path << "is not a version" << trajectoryVersion << "trajectory file";
+        return std::nullopt;
+    }
+
+    if (header.scalarSize != sizeof(Particle::Scalar)) {
+        qCWarning(lcTrajectory).nospace() << path << " was recorded with " << header.scalarSize * 8 << " bit particles, this build uses "
+                                          << sizeof(Particle::Scalar) * 8 << " bit ones (EFFECTRENDERER_FLOAT_PARTICLES)";
+        return std::nullopt;
+    }
+
+    if (header.frameCount == 0 || file.size() < qint64(sizeof(header)) + qint64(header.frameCount) * frameBytes(header.particleCount)) {
+        qCWarning(lcTrajectory) << path << "is incomplete, the recording was probably interrupted";
+        return std::nullopt;
+    }
+
+    return header;
+}
+
+TrajectoryReader::TrajectoryReader(const QString &path, QSize size)
+    : m_file(path)
+{
+    const auto header = readHeader(path);
+    if (!header)
+        return;
+
+    m_header = *header;
+
+    if (!m_file.open(QFile::ReadOnly)) {
+        qCWarning(lcTrajectory) << "could not open" << path << m_file.errorString();
+        return;
+    }
+
+    const auto length = qint64(sizeof(m_header)) + qint64(m_header.frameCount) * frameBytes(m_header.particleCount);
+    const auto data = m_file.map(0, length);
+
+    if (!data) {
+        qCWarning(lcTrajectory) << "could not map" << path << m_file.errorString();
+        return;
+    }
+
+#ifdef Q_OS_UNIX
+    // the frames are read once and in order, let the kernel read ahead and drop them behind us
+    posix_madvise(data, length, POSIX_MADV_SEQUENTIAL);
+#endif
+
+    m_data = data;
+    m_scaleX = qreal(size.width()) / m_header.width;
+    m_scaleY = qreal(size.height()) / m_header.height;
+
+    qCInfo(lcTrajectory).nospace() << "replaying " << m_header.frameCount << " frames of " << m_header.particleCount << " particles from "
+                                   << path << ", recorded at " << m_header.width << "x" << m_header.height;
+}
+
+TrajectoryReader::~TrajectoryReader() = default;
+
+bool TrajectoryReader::replay(quint64 frame, ParticleStore &particles) const
+{
+    if (!m_data || frame >= m_header.frameCount || particles.count() != int(m_header.particleCount)) {
+        qCWarning(lcTrajectory).nospace() << "can't replay frame " << frame << " of " << particles.count() << " particles from "
+                                          << m_file.fileName() << ", it has " << m_header.frameCount << " frames of " << m_header.particleCount;
+        return false;
+    }
+
+    const int count = m_header.particleCount;
+    const auto x = reinterpret_cast<const Particle::Scalar *>(m_data + sizeof(m_header) + qint64(frame) * frameBytes(count));
+    const auto y = x + count;
+    const auto lifeTimes = reinterpret_cast<const quint16 *>(y + count);
+    const auto initialLifeTimes = lifeTimes + count;
+
+    if (frame == 0) {
+        for (int p = 0; p < count; ++p) {
+            particles.init(p, x[p] * m_scaleX, y[p] * m_scaleY, lifeTimes[p]);
+            particles.initialLifeTimes()[p] = initialLifeTimes[p];
+        }
+
+        return true;
+    }
+
+    particles.advance();
+
+    for (int p = 0; p < count; ++p)
+        particles.move(p, x[p] * m_scaleX, y[p] * m_scaleY);
+
+    std::copy_n(lifeTimes, count, particles.lifeTimes());
+    std::copy_n(initialLifeTimes, count, particles.initialLifeTimes());
+    return true;
+}
+
+} // namespace randomly
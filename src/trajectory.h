@@ -0,0 +1,88 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include "particlestore.h"
+
+#include <QFile>
+#include <QSize>
+
+#include <optional>
+#include <vector>
+
+namespace randomly {
+
+// a trajectory file holds the head positions and lifetimes of all particles for every simulated frame, so the same
+// animation can be rasterized again (at another resolution, in other colors) without the noise and the rng.
+// everything is in native byte order:
+//   header, 64 bytes: see TrajectoryHeader
+//   frames, one after the other and each padded to 64 bytes:
+//     Scalar x[particleCount], Scalar y[particleCount], quint16 lifeTime[particleCount], quint16 initialLifeTime[particleCount]
+// so a replay walks through the mapped file front to back and reads the frames in place. Scalar is Particle::Scalar of the
+// recording build, a replay only accepts its own precision so it truncates to exactly the pixels the recording did
+struct TrajectoryHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 particleCount;
+    quint32 width; // the positions are in pixels of this size
+    quint32 height;
+    quint32 seed;
+    quint32 scalarSize; // sizeof(Particle::Scalar)
+    quint64 frameCount; // 0 until the recording is finished
+    quint32 trailLength; // the lifetimes are drawn from a range that depends on it, a replay has to use the same
+    char padding[20];
+};
+
+static_assert(sizeof(TrajectoryHeader) == 64);
+
+class TrajectoryWriter
+{
+public:
+    TrajectoryWriter(const QString &path, QSize size, uint seed, int particleCount, int trailLength);
+    ~TrajectoryWriter();
+
+    // appends the particles' newest positions and lifetimes as the next frame
+    void write(const ParticleStore &particles);
+
+    // puts the frame count into the header, the reader rejects files without one
+    void finish();
+
+    quint64 framesWritten() const { return m_header.frameCount; }
+
+private:
+    QFile m_file;
+    TrajectoryHeader m_header;
+    std::vector<char> m_buffer; // one frame
+    bool m_failed = false;
+    bool m_finished = false;
+};
+
+class TrajectoryReader
+{
+public:
+    // nullopt (and a warning) if path isn't a finished trajectory file of the current version and precision
+    static std::optional<TrajectoryHeader> readHeader(const QString &path);
+
+    // the positions get scaled from the recorded size to size
+    TrajectoryReader(const QString &path, QSize size);
+    ~TrajectoryReader();
+
+    bool isValid() const { return m_data; }
+    const TrajectoryHeader &header() const { return m_header; }
+
+    // frame 0 fills the whole trails like ParticleStore::init(), any later frame advances the store
+    // and has to follow the frame replayed before it. false (and a warning) if the file has no such frame
+    // or a different particle count than the store
+    bool replay(quint64 frame, ParticleStore &particles) const;
+
+private:
+    QFile m_file;
+    TrajectoryHeader m_header = {};
+    const uchar *m_data = nullptr;
+    qreal m_scaleX = 1;
+    qreal m_scaleY = 1;
+};
+
+} // namespace randomly
+
+#endif // TRAJECTORY_H
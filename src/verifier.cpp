@@ -0,0 +1,273 @@
+#include "verifier.h"
+
+#include "renderer.h"
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLoggingCategory>
+
+#include <cmath>
+
+namespace randomly {
+
+namespace
+{
+
+Q_LOGGING_CATEGORY(lcVerifier, "randomly.Verifier");
+
+constexpr int manifestVersion = 1;
+
+QString describe(const RenderInfo &info)
+{
+    return QString("blend=%1 render-mode=%2 fast-trig=%3 scalar-noise=%4 flow-grid=%5 flow-keyframes=%6 tile-size=%7")
+        .arg(info.blendMode == BlendMode::Fast ? "fast" : "exact")
+        .arg(renderModeName(info.renderMode))
+        .arg(info.fastTrig ? 1 : 0)
+        .arg(info.scalarNoise ? 1 : 0)
+        .arg(info.flowGrid)
+        .arg(info.flowKeyframes)
+        .arg(info.tileSize);
+}
+
+} // namespace
+
+ImageDifference compareImages(const QImage &a, const QImage &b)
+{
+    quint64 sum = 0;
+    quint64 squaredSum = 0;
+    int max = 0;
+
+    for (int y = 0; y < a.height(); ++y) {
+        const auto lineA = reinterpret_cast<const QRgb *>(a.constScanLine(y));
+        const auto lineB = reinterpret_cast<const QRgb *>(b.constScanLine(y));
+
+        for (int x = 0; x < a.width(); ++x) {
+            for (const int shift: {0, 8, 16}) {
+                const int d = std::abs(int((lineA[x] >> shift) & 0xff) - int((lineB[x] >> shift) & 0xff));
+
+                sum += d;
+                squaredSum += d * d;
+                max = std::max(max, d);
+            }
+        }
+    }
+
+    const auto samples = qreal(a.width()) * a.height() * 3;
+    const auto mse = squaredSum / samples;
+
+    ImageDifference diff;
+    diff.mean = sum / samples;
+    diff.max = max;
+    diff.psnr = mse > 0 ? 10 * std::log10(255. * 255. / mse) : 99.;
+    return diff;
+}
+
+QString hashImage(const QImage &image)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    const auto lineBytes = qsizetype(image.width()) * 4;
+
+    for (int y = 0; y < image.height(); ++y)
+        hash.addData(QByteArrayView(image.constScanLine(y), lineBytes));
+
+    return QString::fromLatin1(hash.result().toHex());
+}
+
+FrameVerifier::FrameVerifier(VerifyMode mode, const QString &manifest, const RenderInfo &info)
+    : m_mode(mode)
+    , m_manifest(manifest)
+    , m_optimized(describe(info))
+    , m_size(info.size)
+    , m_seed(info.seed)
+    , m_particleCount(info.particleCount)
+    , m_trailLength(info.trailLength)
+{
+    if (m_mode == VerifyMode::Verify) {
+        auto reference = info;
+        reference.blendMode = BlendMode::Exact;
+        reference.renderMode = RenderMode::Trails;
+        reference.fastTrig = false;
+        reference.scalarNoise = true;
+        reference.flowGrid = 0;
+        reference.tileSize = 0;
+        reference.compareTrails = false;
+        reference.saveFrames = false;
+        reference.verifyMode = VerifyMode::Off;
+        reference.recordTrajectory.clear();
+        reference.pixelFormat = PixelFormat::Argb32; // the verifier only looks at the images
+
+        qCInfo(lcVerifier).noquote() << "verifying" << m_optimized << "against" << describe(reference);
+
+        m_reference = std::make_unique<Renderer>(nullptr, reference);
+        m_state = std::make_unique<FrameState>();
+        m_state->lifeTimes.resize(info.particleCount);
+        m_state->initialLifeTimes.resize(info.particleCount);
+    } else {
+        m_manifestValid = loadManifest();
+    }
+}
+
+FrameVerifier::~FrameVerifier() = default;
+
+void FrameVerifier::process(quint64 frame, const QImage &image)
+{
+    if (m_mode == VerifyMode::Verify)
+        verify(frame, image);
+    else
+        check(frame, image);
+}
+
+void FrameVerifier::verify(quint64 frame, const QImage &image)
+{
+    // the reference renders trails, so catching up on skipped frames only takes the simulation
+    for (; m_referenceFrame < frame; ++m_referenceFrame)
+        m_reference->step();
+
+    m_reference->snapshot(frame, *m_state);
+
+    auto referenceFrame = m_reference->rasterize(*m_state);
+    referenceFrame.map(QVideoFrame::ReadOnly);
+
+    const QImage referenceImage(referenceFrame.bits(0), m_size.width(), m_size.height(), referenceFrame.bytesPerLine(0), QImage::Format_ARGB32);
+
+    const auto diff = compareImages(image, referenceImage);
+
+    Entry entry;
+    entry.frame = frame;
+    entry.reference = hashImage(referenceImage);
+    entry.optimized = hashImage(image);
+    entry.max = diff.max;
+    entry.mean = diff.mean;
+
+    referenceFrame.unmap();
+
+    m_identical += entry.reference == entry.optimized;
+    m_max = std::max(m_max, diff.max);
+    m_meanSum += diff.mean;
+
+    qCDebug(lcVerifier).nospace() << "frame " << frame << ": max difference " << diff.max << ", mean difference " << diff.mean;
+
+    m_entries.push_back(entry);
+}
+
+void FrameVerifier::check(quint64 frame, const QImage &image)
+{
+    const auto hash = hashImage(image);
+
+    const auto entry = frame < m_entries.size() ? &m_entries[frame] : nullptr;
+
+    if (entry && hash == entry->reference) {
+        ++m_matchedReference;
+    } else if (entry && hash == entry->optimized) {
+        ++m_matchedOptimized;
+    } else {
+        if (m_firstMismatch < 0)
+            m_firstMismatch = frame;
+
+        ++m_mismatches;
+        qCDebug(lcVerifier) << "frame" << frame << "doesn't match the manifest";
+    }
+}
+
+void FrameVerifier::finish()
+{
+    if (m_mode == VerifyMode::Verify) {
+        const auto frames = std::max<qsizetype>(m_entries.size(), 1);
+
+        qCInfo(lcVerifier).nospace() << m_entries.size() << " frames verified, " << m_identical << " identical to the reference, "
+                                     << "max difference " << m_max << ", mean difference " << m_meanSum / frames;
+
+        m_manifestValid = writeManifest();
+        return;
+    }
+
+    qCInfo(lcVerifier).nospace() << "checked against " << m_manifest << ": " << m_matchedReference << " frames match the reference, "
+                                 << m_matchedOptimized << " the optimized renderer, " << m_mismatches << " neither";
+
+    if (m_mismatches > 0)
+        qCWarning(lcVerifier) << "first mismatch at frame" << m_firstMismatch;
+}
+
+bool FrameVerifier::loadManifest()
+{
+    QFile file(m_manifest);
+    if (!file.open(QFile::ReadOnly)) {
+        qCWarning(lcVerifier) << "could not read" << m_manifest << file.errorString();
+        return false;
+    }
+
+    const auto root = QJsonDocument::fromJson(file.readAll()).object();
+
+    if (root["version"].toInt() != manifestVersion) {
+        qCWarning(lcVerifier) << m_manifest << "is not a version" << manifestVersion << "manifest";
+        return false;
+    }
+
+    // hashes only mean something for the exact same scene
+    if (root["width"].toInt() != m_size.width() || root["height"].toInt() != m_size.height()
+        || root["seed"].toInteger() != m_seed || root["particles"].toInt() != m_particleCount
+        || root["trail_length"].toInt(Particle::queueSize) != m_trailLength) {
+        qCWarning(lcVerifier) << m_manifest << "was written for a different resolution, seed, particle count or trail length";
+        return false;
+    }
+
+    qCInfo(lcVerifier).noquote() << "checking against" << m_manifest << "(optimized:" << root["optimized"].toString() << ")";
+
+    // a manifest might only cover a shard of the animation, frames without an entry never match
+    for (const auto &value: root["frames"].toArray()) {
+        const auto frame = value.toObject();
+
+        Entry entry;
+        entry.frame = frame["frame"].toInteger();
+        entry.reference = frame["reference"].toString();
+        entry.optimized = frame["optimized"].toString();
+
+        if (entry.frame >= m_entries.size())
+            m_entries.resize(entry.frame + 1);
+        m_entries[entry.frame] = entry;
+    }
+
+    return true;
+}
+
+bool FrameVerifier::writeManifest() const
+{
+    QJsonArray frames;
+
+    for (const auto &entry: m_entries) {
+        frames.append(QJsonObject{
+            {"frame", qint64(entry.frame)},
+            {"reference", entry.reference},
+            {"optimized", entry.optimized},
+            {"max_difference", entry.max},
+            {"mean_difference", entry.mean},
+        });
+    }
+
+    const QJsonObject root{
+        {"version", manifestVersion},
+        {"width", m_size.width()},
+        {"height", m_size.height()},
+        {"seed", qint64(m_seed)},
+        {"particles", m_particleCount},
+        {"trail_length", m_trailLength},
+        {"optimized", m_optimized},
+        {"frames", frames},
+    };
+
+    QFile file(m_manifest);
+    const auto json = QJsonDocument(root).toJson();
+
+    if (!file.open(QFile::WriteOnly | QFile::Truncate) || file.write(json) != json.size()) {
+        qCWarning(lcVerifier) << "could not write" << m_manifest << file.errorString();
+        return false;
+    }
+
+    qCInfo(lcVerifier) << "manifest written to" << m_manifest;
+    return true;
+}
+
+} // namespace randomly
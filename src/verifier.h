@@ -0,0 +1,103 @@
+#ifndef VERIFIER_H
+#define VERIFIER_H
+
+#include <QImage>
+#include <QString>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace randomly {
+
+class Renderer;
+struct FrameState;
+struct RenderInfo;
+
+enum class VerifyMode
+{
+    Off,
+    Verify, // render a reference next to every frame, compare them and write a hash manifest
+    Check,  // compare every frame's hash against an existing manifest
+};
+
+struct ImageDifference
+{
+    qreal mean = 0; // per channel, alpha is ignored
+    int max = 0;
+    qreal psnr = 99; // dB, 99 for identical images
+};
+
+// both images need the same size and an ARGB32 format
+ImageDifference compareImages(const QImage &a, const QImage &b);
+
+// hex SHA-1 of the pixels, independent of any padding at the end of the lines
+QString hashImage(const QImage &image);
+
+// cross-checks the optimized kernels against the reference ones.
+// the reference is a second renderer with the scalar noise (and no flow field), exact trigonometry, exact blending and the trails mode,
+// driven one frame at a time from process()
+class FrameVerifier
+{
+public:
+    // `info` describes the optimized renderer the frames come from
+    FrameVerifier(VerifyMode mode, const QString &manifest, const RenderInfo &info);
+    ~FrameVerifier();
+
+    // frames have to arrive in order, but don't have to start at 0
+    void process(quint64 frame, const QImage &image);
+
+    // logs the summary, in verify mode also writes the manifest
+    void finish();
+
+    // false once a frame didn't match the manifest in check mode, or the manifest couldn't be read or written;
+    // verify mode only measures otherwise
+    bool passed() const { return m_mismatches == 0 && m_manifestValid; }
+
+private:
+    void verify(quint64 frame, const QImage &image);
+    void check(quint64 frame, const QImage &image);
+
+    bool loadManifest();
+    bool writeManifest() const;
+
+    const VerifyMode m_mode;
+    const QString m_manifest;
+    const QString m_optimized; // configuration of the optimized renderer, for the manifest
+
+    const QSize m_size;
+    const uint m_seed;
+    const int m_particleCount;
+    const int m_trailLength;
+
+    struct Entry
+    {
+        quint64 frame = 0;
+        QString reference;
+        QString optimized;
+        int max = 0;
+        qreal mean = 0;
+    };
+
+    std::vector<Entry> m_entries; // in order of the frames in verify mode, indexed by the frame in check mode
+
+    // verify mode
+    std::unique_ptr<Renderer> m_reference;
+    std::unique_ptr<FrameState> m_state;
+    quint64 m_referenceFrame = 0; // the frame m_reference's simulation is at
+    int m_identical = 0;
+    int m_max = 0;
+    qreal m_meanSum = 0;
+
+    bool m_manifestValid = true; // could be read in check mode, could be written in verify mode (once finish() ran)
+
+    // check mode
+    int m_matchedReference = 0;
+    int m_matchedOptimized = 0;
+    std::atomic<int> m_mismatches = 0;
+    qint64 m_firstMismatch = -1;
+};
+
+} // namespace randomly
+
+#endif // VERIFIER_H
@@ -0,0 +1,97 @@
+#include "y4mwriter.h"
+
+#include "parallel.h"
+
+#include <QIODevice>
+#include <QLoggingCategory>
+#include <QThreadPool>
+
+#include <cstring>
+
+namespace randomly {
+
+namespace
+{
+
+Q_LOGGING_CATEGORY(lcY4mWriter, "randomly.Y4mWriter");
+
+constexpr char frameTag[] = "FRAME\n";
+constexpr int frameTagSize = sizeof(frameTag) - 1;
+
+} // namespace
+
+Y4mWriter::Y4mWriter(QIODevice *device, QSize size, int frameRate, int threads, bool writeHeader)
+    : m_device(device)
+    , m_size(size)
+    , m_frameRate(frameRate)
+    , m_threads(std::max(threads, 1))
+    , m_pool(std::make_unique<QThreadPool>())
+    , m_headerWritten(!writeHeader)
+{
+    m_pool->setMaxThreadCount(m_threads);
+
+    const int chromaWidth = chromaSize(size.width());
+    const auto lumaBytes = std::size_t(size.width()) * size.height();
+    const auto chromaBytes = std::size_t(chromaWidth) * chromaSize(size.height());
+
+    m_buffer.resize(frameTagSize + lumaBytes + 2 * chromaBytes);
+    std::memcpy(m_buffer.data(), frameTag, frameTagSize);
+
+    m_planes.data[0] = m_buffer.data() + frameTagSize;
+    m_planes.data[1] = m_planes.data[0] + lumaBytes;
+    m_planes.data[2] = m_planes.data[1] + chromaBytes;
+    m_planes.stride[0] = size.width();
+    m_planes.stride[1] = chromaWidth;
+    m_planes.stride[2] = chromaWidth;
+}
+
+Y4mWriter::~Y4mWriter() = default;
+
+bool Y4mWriter::write(const QVideoFrame &frame)
+{
+    if (!m_headerWritten) {
+        // progressive, square pixels, chroma sited in the centre of each 2x2 block like our averaging does
+        const auto header = QString("YUV4MPEG2 W%1 H%2 F%3:1 Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n")
+                                .arg(m_size.width()).arg(m_size.height()).arg(m_frameRate).toLatin1();
+
+        if (m_device->write(header) != header.size())
+            return false;
+
+        m_headerWritten = true;
+    }
+
+    QVideoFrame mapped = frame;
+    if (!mapped.map(QVideoFrame::ReadOnly)) {
+        qCWarning(lcY4mWriter) << "could not map frame" << m_framesWritten;
+        return false;
+    }
+
+    if (mapped.pixelFormat() == QVideoFrameFormat::Format_YUV420P) {
+        // already converted by the renderer, only the strides may differ
+        for (int plane = 0; plane < 3; ++plane) {
+            const int width = plane == 0 ? m_size.width() : chromaSize(m_size.width());
+            const int height = plane == 0 ? m_size.height() : chromaSize(m_size.height());
+
+            for (int y = 0; y < height; ++y)
+                std::memcpy(m_planes.data[plane] + qsizetype(y) * m_planes.stride[plane], mapped.bits(plane) + qsizetype(y) * mapped.bytesPerLine(plane), width);
+        }
+    } else {
+        const auto bits = mapped.bits(0);
+        const int bytesPerLine = mapped.bytesPerLine(0);
+
+        parallelFor(m_pool.get(), chromaSize(m_size.height()), m_threads, [&] (int begin, int end, int) {
+            argbToI420(bits, bytesPerLine, m_size.width(), m_size.height(), m_planes, begin, end);
+        });
+    }
+
+    mapped.unmap();
+
+    const auto size = qint64(m_buffer.size());
+    if (m_device->write(reinterpret_cast<const char *>(m_buffer.data()), size) != size)
+        return false;
+
+    ++m_framesWritten;
+    return true;
+}
+
+} // namespace randomly
@@ -0,0 +1,48 @@
+#ifndef Y4MWRITER_H
+#define Y4MWRITER_H
+
+#include "yuv.h"
+
+#include <QSize>
+#include <QVideoFrame>
+
+#include <memory>
+#include <vector>
+
+class QIODevice;
+class QThreadPool;
+
+namespace randomly {
+
+// streams frames as YUV4MPEG2 (4:2:0) into any device: a file, a FIFO or stdout, so an external encoder can take over.
+// write() blocks until the frame is handed to the device, which propagates a slow consumer back into the pipeline
+class Y4mWriter
+{
+public:
+    // without the stream header, the output can be appended to another shard of the same animation
+    Y4mWriter(QIODevice *device, QSize size, int frameRate, int threads, bool writeHeader = true);
+    ~Y4mWriter();
+
+    // frame has to be ARGB8888 or I420 (which is copied as it is) in the writer's size; returns false if the device didn't take all of it
+    bool write(const QVideoFrame &frame);
+
+    quint64 framesWritten() const { return m_framesWritten; }
+
+private:
+    QIODevice *m_device;
+    const QSize m_size;
+    const int m_frameRate;
+    const int m_threads;
+    std::unique_ptr<QThreadPool> m_pool;
+
+    bool m_headerWritten = false;
+    quint64 m_framesWritten = 0;
+
+    // "FRAME\n" followed by the three planes, written in one go
+    std::vector<uchar> m_buffer;
+    YuvPlanes m_planes;
+};
+
+} // namespace randomly
+
+#endif // Y4MWRITER_H
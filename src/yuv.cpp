@@ -0,0 +1,244 @@
+#include "yuv.h"
+
+#include <QColor>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+namespace randomly {
+
+namespace
+{
+
+#if defined(__GNUC__)
+// the helpers are inlined into the dispatch targets below, so the vector ABI warnings don't apply.
+// like in PerlinNoise, GCC reports them at the end of the translation unit, so this can't be popped again
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+// 8 bit fixed point, shared by the scalar and the vector code so both give the exact same result
+template <typename T>
+inline T luma(const T &r, const T &g, const T &b)
+{
+    return ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+}
+
+template <typename T>
+inline T chromaBlue(const T &r, const T &g, const T &b)
+{
+    return ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+}
+
+template <typename T>
+inline T chromaRed(const T &r, const T &g, const T &b)
+{
+    return ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+inline uchar lumaOf(QRgb px)
+{
+    return luma(qRed(px), qGreen(px), qBlue(px));
+}
+
+// converts the pixels [xBegin, width) of a row pair, row1 may be row0 again for the last row of an odd height.
+// with Nv12, u points to the interleaved chroma row and v is unused
+template <bool Nv12>
+void convertPairScalar(const QRgb *row0, const QRgb *row1, int xBegin, int width, uchar *y0, uchar *y1, uchar *u, uchar *v)
+{
+    for (int x = xBegin; x < width; x += 2) {
+        const int x1 = std::min(x + 1, width - 1);
+
+        y0[x] = lumaOf(row0[x]);
+        y1[x] = lumaOf(row1[x]);
+        y0[x1] = lumaOf(row0[x1]);
+        y1[x1] = lumaOf(row1[x1]);
+
+        const int r = (qRed(row0[x])   + qRed(row0[x1])   + qRed(row1[x])   + qRed(row1[x1])   + 2) >> 2;
+        const int g = (qGreen(row0[x]) + qGreen(row0[x1]) + qGreen(row1[x]) + qGreen(row1[x1]) + 2) >> 2;
+        const int b = (qBlue(row0[x])  + qBlue(row0[x1])  + qBlue(row1[x])  + qBlue(row1[x1])  + 2) >> 2;
+
+        if constexpr (Nv12) {
+            u[x] = chromaBlue(r, g, b);
+            u[x + 1] = chromaRed(r, g, b);
+        } else {
+            u[x / 2] = chromaBlue(r, g, b);
+            v[x / 2] = chromaRed(r, g, b);
+        }
+    }
+}
+
+template <bool Nv12, void (*ConvertBlock)(const QRgb *, const QRgb *, uchar *, uchar *, uchar *, uchar *), int BlockWidth>
+inline void convertRows(const uchar *argb, int argbStride, int width, int height, const YuvPlanes &out, int chromaBegin, int chromaEnd)
+{
+    for (int cy = chromaBegin; cy < chromaEnd; ++cy) {
+        const int top = 2 * cy;
+        const bool hasBottom = top + 1 < height;
+
+        const auto row0 = reinterpret_cast<const QRgb *>(argb + qsizetype(top) * argbStride);
+        const auto row1 = hasBottom ? reinterpret_cast<const QRgb *>(reinterpret_cast<const uchar *>(row0) + argbStride) : row0;
+        const auto y0 = out.data[0] + qsizetype(top) * out.stride[0];
+        const auto y1 = hasBottom ? y0 + out.stride[0] : y0;
+        const auto u = out.data[1] + qsizetype(cy) * out.stride[1];
+        const auto v = Nv12 ? nullptr : out.data[2] + qsizetype(cy) * out.stride[2];
+
+        int x = 0;
+        if constexpr (BlockWidth > 0) {
+            for (; x + BlockWidth <= width; x += BlockWidth) {
+                if constexpr (Nv12)
+                    ConvertBlock(row0 + x, row1 + x, y0 + x, y1 + x, u + x, nullptr);
+                else
+                    ConvertBlock(row0 + x, row1 + x, y0 + x, y1 + x, u + x / 2, v + x / 2);
+            }
+        }
+
+        convertPairScalar<Nv12>(row0, row1, x, width, y0, y1, u, v);
+    }
+}
+
+#if defined(__GNUC__)
+#define YUV_INLINE inline __attribute__((always_inline))
+
+template <int Lanes>
+struct YuvVec {
+    typedef std::int32_t V __attribute__((vector_size(4 * Lanes)));
+    typedef std::uint8_t B __attribute__((vector_size(Lanes)));
+};
+
+template <typename V, std::size_t... I>
+YUV_INLINE V evenLanes(const V &a, const V &b, std::index_sequence<I...>)
+{
+    return __builtin_shufflevector(a, b, (2 * I)...);
+}
+
+template <typename V, std::size_t... I>
+YUV_INLINE V oddLanes(const V &a, const V &b, std::index_sequence<I...>)
+{
+    return __builtin_shufflevector(a, b, (2 * I + 1)...);
+}
+
+template <typename V, std::size_t... I>
+YUV_INLINE auto interleave(const V &a, const V &b, std::index_sequence<I...>)
+{
+    return __builtin_shufflevector(a, b, (I / 2 + (I % 2) * sizeof...(I) / 2)...);
+}
+
+template <int Lanes>
+YUV_INLINE void storeBytes(uchar *dst, const typename YuvVec<Lanes>::V &v)
+{
+    const auto bytes = __builtin_convertvector(v, typename YuvVec<Lanes>::B);
+    std::memcpy(dst, &bytes, Lanes);
+}
+
+// a and b alternating, 2 * Lanes bytes
+template <int Lanes>
+YUV_INLINE void storeInterleaved(uchar *dst, const typename YuvVec<Lanes>::V &a, const typename YuvVec<Lanes>::V &b)
+{
+    const auto bytes = __builtin_convertvector(interleave(a, b, std::make_index_sequence<2 * Lanes>()), typename YuvVec<2 * Lanes>::B);
+    std::memcpy(dst, &bytes, 2 * Lanes);
+}
+
+// 2 * Lanes pixels of two rows: all of their luma and Lanes chroma samples, with Nv12 interleaved at u
+template <int Lanes, bool Nv12>
+YUV_INLINE void convertBlock(const QRgb *row0, const QRgb *row1, uchar *y0, uchar *y1, uchar *u, uchar *v)
+{
+    using V = typename YuvVec<Lanes>::V;
+    constexpr auto lanes = std::make_index_sequence<Lanes>();
+
+    V px[4];
+    std::memcpy(&px[0], row0, sizeof(V));
+    std::memcpy(&px[1], row0 + Lanes, sizeof(V));
+    std::memcpy(&px[2], row1, sizeof(V));
+    std::memcpy(&px[3], row1 + Lanes, sizeof(V));
+
+    V r[4], g[4], b[4];
+    for (int i = 0; i < 4; ++i) {
+        r[i] = (px[i] >> 16) & 255;
+        g[i] = (px[i] >> 8) & 255;
+        b[i] = px[i] & 255;
+    }
+
+    storeBytes<Lanes>(y0, luma(r[0], g[0], b[0]));
+    storeBytes<Lanes>(y0 + Lanes, luma(r[1], g[1], b[1]));
+    storeBytes<Lanes>(y1, luma(r[2], g[2], b[2]));
+    storeBytes<Lanes>(y1 + Lanes, luma(r[3], g[3], b[3]));
+
+    // vertical sums first, then add up neighbouring columns
+    const auto average = [&lanes] (const V (&c)[4]) {
+        const V left = c[0] + c[2];
+        const V right = c[1] + c[3];
+        return (evenLanes(left, right, lanes) + oddLanes(left, right, lanes) + 2) >> 2;
+    };
+
+    const V ra = average(r);
+    const V ga = average(g);
+    const V ba = average(b);
+
+    if constexpr (Nv12) {
+        storeInterleaved<Lanes>(u, chromaBlue(ra, ga, ba), chromaRed(ra, ga, ba));
+    } else {
+        storeBytes<Lanes>(u, chromaBlue(ra, ga, ba));
+        storeBytes<Lanes>(v, chromaRed(ra, ga, ba));
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+template <bool Nv12>
+__attribute__((target("avx2")))
+void convertAvx2(const uchar *argb, int argbStride, int width, int height, const YuvPlanes &out, int chromaBegin, int chromaEnd)
+{
+    convertRows<Nv12, convertBlock<8, Nv12>, 16>(argb, argbStride, width, height, out, chromaBegin, chromaEnd);
+}
+
+bool hasAvx2()
+{
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+}
+#else
+template <bool Nv12>
+void convertAvx2(const uchar *, int, int, int, const YuvPlanes &, int, int) {}
+
+bool hasAvx2()
+{
+    return false;
+}
+#endif
+
+// 16 byte vectors, SSE2 on x86 and NEON on ARM
+template <bool Nv12>
+void convert128(const uchar *argb, int argbStride, int width, int height, const YuvPlanes &out, int chromaBegin, int chromaEnd)
+{
+    convertRows<Nv12, convertBlock<4, Nv12>, 8>(argb, argbStride, width, height, out, chromaBegin, chromaEnd);
+}
+
+#undef YUV_INLINE
+#endif // __GNUC__
+
+template <bool Nv12>
+void convert(const uchar *argb, int argbStride, int width, int height, const YuvPlanes &out, int chromaBegin, int chromaEnd)
+{
+#if defined(__GNUC__)
+    if (hasAvx2())
+        convertAvx2<Nv12>(argb, argbStride, width, height, out, chromaBegin, chromaEnd);
+    else
+        convert128<Nv12>(argb, argbStride, width, height, out, chromaBegin, chromaEnd);
+#else
+    convertRows<Nv12, nullptr, 0>(argb, argbStride, width, height, out, chromaBegin, chromaEnd);
+#endif
+}
+
+} // namespace
+
+void argbToI420(const uchar *argb, int argbStride, int width, int height, const YuvPlanes &out, int chromaBegin, int chromaEnd)
+{
+    convert<false>(argb, argbStride, width, height, out, chromaBegin, chromaEnd);
+}
+
+void argbToNv12(const uchar *argb, int argbStride, int width, int height, const YuvPlanes &out, int chromaBegin, int chromaEnd)
+{
+    convert<true>(argb, argbStride, width, height, out, chromaBegin, chromaEnd);
+}
+
+} // namespace randomly
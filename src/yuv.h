@@ -0,0 +1,31 @@
+#ifndef YUV_H
+#define YUV_H
+
+#include <QtGlobal>
+
+namespace randomly {
+
+// the planes of an I420 (or NV12) image, chroma has half the resolution in both directions (rounded up)
+struct YuvPlanes
+{
+    uchar *data[3] = {};
+    int stride[3] = {};
+};
+
+// converts ARGB32 to I420 using BT.601 limited range coefficients (what Y4M consumers assume without any further tags),
+// chroma is the rounded average of each 2x2 block. only converts the chroma rows [chromaBegin, chromaEnd), which is
+// twice as many luma rows, so several threads can work on one image.
+// vectorized with AVX2 when the CPU supports it, the result is the same on every code path
+void argbToI420(const uchar *argb, int argbStride, int width, int height, const YuvPlanes &out, int chromaBegin, int chromaEnd);
+
+// the same into NV12: out.data[1] holds u and v interleaved (so its stride covers twice the chroma width), out.data[2] is unused
+void argbToNv12(const uchar *argb, int argbStride, int width, int height, const YuvPlanes &out, int chromaBegin, int chromaEnd);
+
+inline int chromaSize(int lumaSize)
+{
+    return (lumaSize + 1) / 2;
+}
+
+} // namespace randomly
+
+#endif // YUV_H